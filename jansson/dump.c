@@ -226,9 +226,27 @@ static int compare_keys(const void *key1, const void *key2)
 	return strcmp(*(const char **)key1, *(const char **)key2);
 }
 
+/* The containers enclosing the value being dumped, innermost first.  Circular
+   references are found by looking for the value in this chain rather than by
+   marking it, so dumping never writes to the value being dumped. */
+struct dump_parent {
+	const json_t *json;
+	const struct dump_parent *next;
+};
+
+static int dump_is_parent(const struct dump_parent *parent, const json_t *json)
+{
+	for (; parent; parent = parent->next) {
+		if (parent->json == json)
+			return 1;
+	}
+	return 0;
+}
+
 static int do_dump(const json_t *json, size_t flags, int depth,
-	json_dump_callback_t dump, void *data)
+	const struct dump_parent *parents, json_dump_callback_t dump, void *data)
 {
+	struct dump_parent self;
 	int embed = flags & JSON_EMBED;
 
 	flags &= ~JSON_EMBED;
@@ -236,6 +254,9 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 	if (!json)
 		return -1;
 
+	self.json = json;
+	self.next = parents;
+
 	switch (json_typeof(json)) {
 	case JSON_NULL:
 		return dump("null", 4, data);
@@ -285,54 +306,42 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 		size_t n;
 		size_t i;
 
-		json_array_t *array;
-
 		/* detect circular references */
-		array = json_to_array(json);
-		if (array->visited)
-			goto array_error;
-		array->visited = 1;
+		if (dump_is_parent(parents, json))
+			return -1;
 
 		n = json_array_size(json);
 
 		if (!embed && dump("[", 1, data))
-			goto array_error;
-		if (n == 0) {
-			array->visited = 0;
+			return -1;
+		if (n == 0)
 			return embed ? 0 : dump("]", 1, data);
-		}
 		if (dump_indent(flags, depth + 1, 0, dump, data))
-			goto array_error;
+			return -1;
 
 		for (i = 0; i < n; ++i) {
 			if (do_dump(json_array_get(json, i), flags, depth + 1,
-				dump, data))
-				goto array_error;
+				&self, dump, data))
+				return -1;
 
 			if (i < n - 1)
 			{
 				if (dump(",", 1, data) ||
 					dump_indent(flags, depth + 1, 1, dump, data))
-					goto array_error;
+					return -1;
 			}
 			else
 			{
 				if (dump_indent(flags, depth, 0, dump, data))
-					goto array_error;
+					return -1;
 			}
 		}
 
-		array->visited = 0;
 		return embed ? 0 : dump("]", 1, data);
-
-	array_error:
-		array->visited = 0;
-		return -1;
 	}
 
 	case JSON_OBJECT:
 	{
-		json_object_t *object;
 		void *iter;
 		const char *separator;
 		int separator_length;
@@ -347,21 +356,17 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 		}
 
 		/* detect circular references */
-		object = json_to_object(json);
-		if (object->visited)
-			goto object_error;
-		object->visited = 1;
+		if (dump_is_parent(parents, json))
+			return -1;
 
 		iter = json_object_iter((json_t *)json);
 
 		if (!embed && dump("{", 1, data))
-			goto object_error;
-		if (!iter) {
-			object->visited = 0;
+			return -1;
+		if (!iter)
 			return embed ? 0 : dump("}", 1, data);
-		}
 		if (dump_indent(flags, depth + 1, 0, dump, data))
-			goto object_error;
+			return -1;
 
 		if (flags & JSON_SORT_KEYS)
 		{
@@ -371,7 +376,7 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 			size = json_object_size(json);
 			keys = jsonp_malloc(size * sizeof(const char *));
 			if (!keys)
-				goto object_error;
+				return -1;
 
 			i = 0;
 			while (iter)
@@ -395,10 +400,10 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 
 				dump_string(key, strlen(key), dump, data, flags);
 				if (dump(separator, separator_length, data) ||
-					do_dump(value, flags, depth + 1, dump, data))
+					do_dump(value, flags, depth + 1, &self, dump, data))
 				{
 					jsonp_free(keys);
-					goto object_error;
+					return -1;
 				}
 
 				if (i < size - 1)
@@ -407,7 +412,7 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 						dump_indent(flags, depth + 1, 1, dump, data))
 					{
 						jsonp_free(keys);
-						goto object_error;
+						return -1;
 					}
 				}
 				else
@@ -415,7 +420,7 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 					if (dump_indent(flags, depth, 0, dump, data))
 					{
 						jsonp_free(keys);
-						goto object_error;
+						return -1;
 					}
 				}
 			}
@@ -434,31 +439,26 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 				dump_string(key, strlen(key), dump, data, flags);
 				if (dump(separator, separator_length, data) ||
 					do_dump(json_object_iter_value(iter), flags, depth + 1,
-						dump, data))
-					goto object_error;
+						&self, dump, data))
+					return -1;
 
 				if (next)
 				{
 					if (dump(",", 1, data) ||
 						dump_indent(flags, depth + 1, 1, dump, data))
-						goto object_error;
+						return -1;
 				}
 				else
 				{
 					if (dump_indent(flags, depth, 0, dump, data))
-						goto object_error;
+						return -1;
 				}
 
 				iter = next;
 			}
 		}
 
-		object->visited = 0;
 		return embed ? 0 : dump("}", 1, data);
-
-	object_error:
-		object->visited = 0;
-		return -1;
 	}
 
 	default:
@@ -525,5 +525,5 @@ int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *
 			return -1;
 	}
 
-	return do_dump(json, flags, 0, callback, data);
+	return do_dump(json, flags, 0, NULL, callback, data);
 }
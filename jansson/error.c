@@ -13,6 +13,7 @@ void jsonp_error_init(json_error_t *error, const char *source)
     if(error)
     {
         error->text[0] = '\0';
+        error->text[JSON_ERROR_TEXT_LENGTH - 1] = (char)json_error_unknown;
         error->line = -1;
         error->column = -1;
         error->position = 0;
@@ -65,6 +66,58 @@ void jsonp_error_vset(json_error_t *error, int line, int column,
     error->column = column;
     error->position = (int)position;
 
-    vsnprintf(error->text, JSON_ERROR_TEXT_LENGTH, msg, ap);
-    error->text[JSON_ERROR_TEXT_LENGTH - 1] = '\0';
+    /* the last byte holds the error code */
+    vsnprintf(error->text, JSON_ERROR_TEXT_LENGTH - 1, msg, ap);
+    error->text[JSON_ERROR_TEXT_LENGTH - 2] = '\0';
+    error->text[JSON_ERROR_TEXT_LENGTH - 1] = (char)json_error_unknown;
+}
+
+void jsonp_error_set_text(json_error_t *error, int line, int column,
+                          size_t position, enum json_error_code code,
+                          const char *text)
+{
+    size_t length;
+
+    if(!error)
+        return;
+
+    if(error->text[0] != '\0') {
+        /* error already set */
+        return;
+    }
+
+    error->line = line;
+    error->column = column;
+    error->position = (int)position;
+
+    length = strlen(text);
+    if(length > JSON_ERROR_TEXT_LENGTH - 2)
+        length = JSON_ERROR_TEXT_LENGTH - 2;
+    memcpy(error->text, text, length);
+    error->text[length] = '\0';
+    error->text[JSON_ERROR_TEXT_LENGTH - 1] = (char)code;
+}
+
+const char *jsonp_error_code_text(enum json_error_code code)
+{
+    switch(code) {
+        case json_error_out_of_memory: return "out of memory";
+        case json_error_stack_overflow: return "maximum parsing depth reached";
+        case json_error_cannot_open_file: return "unable to open file";
+        case json_error_invalid_argument: return "wrong arguments";
+        case json_error_invalid_utf8: return "invalid UTF-8";
+        case json_error_premature_end_of_input: return "premature end of input";
+        case json_error_end_of_input_expected: return "end of file expected";
+        case json_error_invalid_syntax: return "invalid syntax";
+        case json_error_invalid_format: return "invalid format";
+        case json_error_wrong_type: return "wrong type";
+        case json_error_null_character: return "\\u0000 is not allowed without JSON_ALLOW_NUL";
+        case json_error_null_value: return "null value";
+        case json_error_null_byte_in_key: return "NUL byte in object key not supported";
+        case json_error_duplicate_key: return "duplicate object key";
+        case json_error_numeric_overflow: return "numeric overflow";
+        case json_error_item_not_found: return "item not found";
+        case json_error_index_out_of_range: return "index out of range";
+        default: return "unknown error";
+    }
 }
@@ -283,6 +283,20 @@ void *hashtable_get(hashtable_t *hashtable, const char *key)
     return pair->value;
 }
 
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t hash)
+{
+    pair_t *pair;
+    bucket_t *bucket;
+
+    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+
+    pair = hashtable_find_pair(hashtable, bucket, key, hash);
+    if(!pair)
+        return NULL;
+
+    return pair->value;
+}
+
 int hashtable_del(hashtable_t *hashtable, const char *key)
 {
     size_t hash = hash_str(key);
@@ -347,6 +361,26 @@ void *hashtable_iter_value(void *iter)
     return pair->value;
 }
 
+size_t hashtable_iter_hash(void *iter)
+{
+    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    return pair->hash;
+}
+
+size_t jsonp_hash_bytes(const void *data, size_t length)
+{
+    /* Hashes must not change once they're cached, so seed first */
+    if(!hashtable_seed)
+        json_object_seed(0);
+
+    return (size_t)hashlittle(data, length, hashtable_seed);
+}
+
+uint32_t jsonp_hash_bytes_fixed(const void *data, size_t length)
+{
+    return hashlittle(data, length, 0);
+}
+
 void hashtable_iter_set(void *iter, json_t *value)
 {
     pair_t *pair = ordered_list_to_pair((list_t *)iter);
@@ -93,6 +93,17 @@ int hashtable_set(hashtable_t *hashtable, const char *key, json_t *value);
  */
 void *hashtable_get(hashtable_t *hashtable, const char *key);
 
+/**
+ * hashtable_get_hashed - Get a value associated with a key whose hash is known
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @hash: The hash of the key, as returned by jsonp_hash_bytes()
+ *
+ * Returns value if it is found, or NULL otherwise.
+ */
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t hash);
+
 /**
  * hashtable_del - Remove a value from the hashtable
  *
@@ -165,6 +176,13 @@ void *hashtable_iter_key(void *iter);
  */
 void *hashtable_iter_value(void *iter);
 
+/**
+ * hashtable_iter_hash - Retrieve the hash of the key pointed by an iterator
+ *
+ * @iter: The iterator
+ */
+size_t hashtable_iter_hash(void *iter);
+
 /**
  * hashtable_iter_set - Set the value pointed by an iterator
  *
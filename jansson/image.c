@@ -0,0 +1,470 @@
+/*
+ * Flattened, relocatable, read-only images of json_t values.
+ *
+ * An image is a single contiguous buffer that holds a whole tree.  Nodes
+ * refer to each other by offsets relative to themselves, so an image can be
+ * written to a file, memfd or shared memory segment once and then mapped at
+ * any address by any number of processes and read in place, with no parsing
+ * and no allocation.  Object members are sorted by a fixed (unseeded) hash
+ * of their key, so lookups are a binary search.
+ *
+ * Every node is 8 byte aligned and starts with an image_node_t, followed by
+ * its payload:
+ *
+ *   string, mem: the bytes, then a NUL
+ *   array:       one int64_t offset per element
+ *   object:      one image_member_t per member, then the NUL terminated keys
+ *
+ * Images are trusted: json_image_root() checks the header, but the nodes
+ * themselves are not validated, so only map images written by json_image_*
+ * dump functions.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "strbuffer.h"
+
+#define IMAGE_MAGIC   0x474d494a /* "JIMG" */
+#define IMAGE_VERSION 1
+#define IMAGE_ALIGN   8
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	int64_t root;
+} image_header_t;
+
+struct json_image_node {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t value; /* integer or real bits, or the length or count */
+};
+
+typedef struct {
+	uint64_t hash;
+	uint64_t key_length;
+	int64_t key;
+	int64_t value;
+} image_member_t;
+
+#define node_payload(node_) ((const char *)(node_) + sizeof(json_image_node_t))
+#define node_at(node_, offset_) ((const json_image_node_t *)((const char *)(node_) + (offset_)))
+
+/*** writing ***/
+
+typedef struct {
+	const char *key;
+	size_t key_length;
+	uint64_t hash;
+	const json_t *value;
+} member_sort_t;
+
+static size_t align_up(size_t size)
+{
+	return (size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+}
+
+/* Reserves space for size bytes at the end of the image, zero filled and
+   aligned, and returns its offset, or (size_t)-1 on failure */
+static size_t image_reserve(strbuffer_t *image, size_t size)
+{
+	static const char zeros[IMAGE_ALIGN * 4] = { 0 };
+	size_t offset = image->length;
+	size_t remaining = align_up(size);
+
+	while (remaining) {
+		size_t chunk = remaining < sizeof(zeros) ? remaining : sizeof(zeros);
+		if (strbuffer_append_bytes(image, zeros, chunk))
+			return (size_t)-1;
+		remaining -= chunk;
+	}
+	return offset;
+}
+
+static size_t image_node(strbuffer_t *image, int type, uint64_t value, size_t payload)
+{
+	json_image_node_t *node;
+	size_t offset;
+
+	offset = image_reserve(image, sizeof(json_image_node_t) + payload);
+	if (offset == (size_t)-1)
+		return offset;
+
+	node = (json_image_node_t *)(image->value + offset);
+	node->type = (uint32_t)type;
+	node->value = value;
+	return offset;
+}
+
+static int compare_members(const void *a, const void *b)
+{
+	const member_sort_t *m1 = (const member_sort_t *)a;
+	const member_sort_t *m2 = (const member_sort_t *)b;
+
+	if (m1->hash != m2->hash)
+		return m1->hash < m2->hash ? -1 : 1;
+	return strcmp(m1->key, m2->key);
+}
+
+static size_t image_write(strbuffer_t *image, const json_t *json);
+
+static size_t image_write_bytes(strbuffer_t *image, int type, const char *data, size_t length)
+{
+	size_t offset;
+
+	offset = image_node(image, type, length, length + 1);
+	if (offset != (size_t)-1 && length)
+		memcpy(image->value + offset + sizeof(json_image_node_t), data, length);
+	return offset;
+}
+
+static size_t image_write_array(strbuffer_t *image, const json_t *json)
+{
+	json_array_t *array = json_to_array(json);
+	size_t offset, child, i, n;
+
+	/* detect circular references */
+	if (array->visited)
+		return (size_t)-1;
+	array->visited = 1;
+
+	n = json_array_size(json);
+	offset = image_node(image, JSON_ARRAY, n, n * sizeof(int64_t));
+
+	for (i = 0; offset != (size_t)-1 && i < n; i++) {
+		child = image_write(image, json_array_get(json, i));
+		if (child == (size_t)-1)
+			offset = child;
+		else {
+			/* the buffer may have moved, so look the slot up again */
+			int64_t rel = (int64_t)child - (int64_t)offset;
+			memcpy(image->value + offset + sizeof(json_image_node_t) + i * sizeof(int64_t),
+				&rel, sizeof(rel));
+		}
+	}
+
+	array->visited = 0;
+	return offset;
+}
+
+static size_t image_write_object(strbuffer_t *image, const json_t *json)
+{
+	json_object_t *object = json_to_object(json);
+	member_sort_t *members;
+	size_t offset = (size_t)-1, keys_size = 0, key_offset, i, n;
+	void *iter;
+
+	/* detect circular references */
+	if (object->visited)
+		return (size_t)-1;
+	object->visited = 1;
+
+	n = json_object_size(json);
+	members = jsonp_malloc((n ? n : 1) * sizeof(member_sort_t));
+	if (!members)
+		goto out;
+
+	iter = json_object_iter((json_t *)json);
+	for (i = 0; iter; i++) {
+		members[i].key = json_object_iter_key(iter);
+		members[i].key_length = strlen(members[i].key);
+		members[i].hash = jsonp_hash_bytes_fixed(members[i].key, members[i].key_length);
+		members[i].value = json_object_iter_value(iter);
+		keys_size += members[i].key_length + 1;
+		iter = json_object_iter_next((json_t *)json, iter);
+	}
+	if (n)
+		qsort(members, n, sizeof(member_sort_t), compare_members);
+
+	offset = image_node(image, JSON_OBJECT, n, n * sizeof(image_member_t) + keys_size);
+	if (offset == (size_t)-1)
+		goto out;
+
+	key_offset = sizeof(json_image_node_t) + n * sizeof(image_member_t);
+	for (i = 0; i < n; i++) {
+		image_member_t member;
+		size_t child;
+
+		child = image_write(image, members[i].value);
+		if (child == (size_t)-1) {
+			offset = child;
+			goto out;
+		}
+
+		member.hash = members[i].hash;
+		member.key_length = members[i].key_length;
+		member.key = (int64_t)key_offset;
+		member.value = (int64_t)child - (int64_t)offset;
+		memcpy(image->value + offset + key_offset, members[i].key, members[i].key_length + 1);
+		memcpy(image->value + offset + sizeof(json_image_node_t) + i * sizeof(image_member_t),
+			&member, sizeof(member));
+		key_offset += members[i].key_length + 1;
+	}
+
+out:
+	jsonp_free(members);
+	object->visited = 0;
+	return offset;
+}
+
+static size_t image_write(strbuffer_t *image, const json_t *json)
+{
+	switch (json_typeof(json)) {
+	case JSON_NULL:
+	case JSON_TRUE:
+	case JSON_FALSE:
+		return image_node(image, json_typeof(json), 0, 0);
+
+	case JSON_INTEGER:
+		return image_node(image, JSON_INTEGER, (uint64_t)json_integer_value(json), 0);
+
+	case JSON_REAL:
+	{
+		double real = json_real_value(json);
+		uint64_t bits;
+
+		memcpy(&bits, &real, sizeof(bits));
+		return image_node(image, JSON_REAL, bits, 0);
+	}
+
+	case JSON_STRING:
+		return image_write_bytes(image, JSON_STRING, json_string_value(json), json_string_length(json));
+
+	case JSON_MEM:
+		return image_write_bytes(image, JSON_MEM, json_mem_value(json), json_mem_length(json));
+
+	case JSON_ARRAY:
+		return image_write_array(image, json);
+
+	case JSON_OBJECT:
+		return image_write_object(image, json);
+
+	default:
+		return (size_t)-1;
+	}
+}
+
+char *json_image_dumps(const json_t *json, size_t *size)
+{
+	strbuffer_t image;
+	image_header_t *header;
+	size_t root;
+
+	if (!json || strbuffer_init(&image))
+		return NULL;
+
+	if (image_reserve(&image, sizeof(image_header_t)) == (size_t)-1)
+		goto error;
+
+	root = image_write(&image, json);
+	if (root == (size_t)-1)
+		goto error;
+
+	header = (image_header_t *)image.value;
+	header->magic = IMAGE_MAGIC;
+	header->version = IMAGE_VERSION;
+	header->size = image.length;
+	header->root = (int64_t)root;
+
+	if (size)
+		*size = image.length;
+	return strbuffer_steal_value(&image);
+
+error:
+	strbuffer_close(&image);
+	return NULL;
+}
+
+size_t json_image_dumpb(const json_t *json, char *buffer, size_t size)
+{
+	size_t length;
+	char *image;
+
+	image = json_image_dumps(json, &length);
+	if (!image)
+		return 0;
+
+	if (length <= size)
+		memcpy(buffer, image, length);
+	jsonp_free(image);
+	return length;
+}
+
+/*** reading ***/
+
+const json_image_node_t *json_image_root(const void *image, size_t size)
+{
+	const image_header_t *header = (const image_header_t *)image;
+
+	if (!image || size < sizeof(image_header_t) || ((uintptr_t)image & (IMAGE_ALIGN - 1)))
+		return NULL;
+
+	if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION ||
+		header->size > size || header->root < (int64_t)sizeof(image_header_t) ||
+		(uint64_t)header->root + sizeof(json_image_node_t) > header->size)
+		return NULL;
+
+	return node_at(image, header->root);
+}
+
+json_type json_image_typeof(const json_image_node_t *node)
+{
+	return (json_type)node->type;
+}
+
+size_t json_image_size(const json_image_node_t *node)
+{
+	if (!node || (node->type != JSON_ARRAY && node->type != JSON_OBJECT))
+		return 0;
+	return (size_t)node->value;
+}
+
+const json_image_node_t *json_image_array_get(const json_image_node_t *array, size_t index)
+{
+	int64_t offset;
+
+	if (!array || array->type != JSON_ARRAY || index >= array->value)
+		return NULL;
+
+	memcpy(&offset, node_payload(array) + index * sizeof(int64_t), sizeof(offset));
+	return node_at(array, offset);
+}
+
+static const image_member_t *image_member(const json_image_node_t *object, size_t index)
+{
+	return (const image_member_t *)node_payload(object) + index;
+}
+
+const json_image_node_t *json_image_object_get(const json_image_node_t *object, const char *key)
+{
+	const image_member_t *member;
+	size_t key_length, low, high, mid;
+	uint64_t hash;
+
+	if (!object || !key || object->type != JSON_OBJECT)
+		return NULL;
+
+	key_length = strlen(key);
+	hash = jsonp_hash_bytes_fixed(key, key_length);
+
+	/* find the first member with a hash >= the key's */
+	low = 0;
+	high = (size_t)object->value;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (image_member(object, mid)->hash < hash)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (; low < object->value; low++) {
+		member = image_member(object, low);
+		if (member->hash != hash)
+			break;
+		if (member->key_length == key_length &&
+			memcmp((const char *)object + member->key, key, key_length) == 0)
+			return node_at(object, member->value);
+	}
+	return NULL;
+}
+
+const char *json_image_object_key(const json_image_node_t *object, size_t index)
+{
+	if (!object || object->type != JSON_OBJECT || index >= object->value)
+		return NULL;
+	return (const char *)object + image_member(object, index)->key;
+}
+
+const json_image_node_t *json_image_object_value(const json_image_node_t *object, size_t index)
+{
+	if (!object || object->type != JSON_OBJECT || index >= object->value)
+		return NULL;
+	return node_at(object, image_member(object, index)->value);
+}
+
+const char *json_image_string_value(const json_image_node_t *node)
+{
+	if (!node || (node->type != JSON_STRING && node->type != JSON_MEM))
+		return NULL;
+	return node_payload(node);
+}
+
+size_t json_image_string_length(const json_image_node_t *node)
+{
+	if (!node || (node->type != JSON_STRING && node->type != JSON_MEM))
+		return 0;
+	return (size_t)node->value;
+}
+
+json_int_t json_image_integer_value(const json_image_node_t *node)
+{
+	if (!node || node->type != JSON_INTEGER)
+		return 0;
+	return (json_int_t)(int64_t)node->value;
+}
+
+double json_image_real_value(const json_image_node_t *node)
+{
+	double real;
+
+	if (!node || node->type != JSON_REAL)
+		return 0.0;
+	memcpy(&real, &node->value, sizeof(real));
+	return real;
+}
+
+json_t *json_image_load(const json_image_node_t *node)
+{
+	json_t *result;
+	size_t i;
+
+	if (!node)
+		return NULL;
+
+	switch (node->type) {
+	case JSON_NULL:
+		return json_null();
+	case JSON_TRUE:
+		return json_true();
+	case JSON_FALSE:
+		return json_false();
+	case JSON_INTEGER:
+		return json_integer(json_image_integer_value(node));
+	case JSON_REAL:
+		return json_real(json_image_real_value(node));
+	case JSON_STRING:
+		return json_stringn_nocheck(node_payload(node), (size_t)node->value);
+	case JSON_MEM:
+		return json_mem(node_payload(node), (size_t)node->value);
+
+	case JSON_ARRAY:
+		result = json_array();
+		for (i = 0; result && i < node->value; i++) {
+			if (json_array_append_new(result, json_image_load(json_image_array_get(node, i)))) {
+				json_decref(result);
+				return NULL;
+			}
+		}
+		return result;
+
+	case JSON_OBJECT:
+		result = json_object();
+		for (i = 0; result && i < node->value; i++) {
+			if (json_object_set_new_nocheck(result, json_image_object_key(node, i),
+				json_image_load(json_image_object_value(node, i)))) {
+				json_decref(result);
+				return NULL;
+			}
+		}
+		return result;
+
+	default:
+		return NULL;
+	}
+}
@@ -156,6 +156,34 @@ extern "C" {
 		char text[JSON_ERROR_TEXT_LENGTH];
 	} json_error_t;
 
+	/* The loaders keep an error code in the last byte of text */
+	enum json_error_code {
+		json_error_unknown,
+		json_error_out_of_memory,
+		json_error_stack_overflow,
+		json_error_cannot_open_file,
+		json_error_invalid_argument,
+		json_error_invalid_utf8,
+		json_error_premature_end_of_input,
+		json_error_end_of_input_expected,
+		json_error_invalid_syntax,
+		json_error_invalid_format,
+		json_error_wrong_type,
+		json_error_null_character,
+		json_error_null_value,
+		json_error_null_byte_in_key,
+		json_error_duplicate_key,
+		json_error_numeric_overflow,
+		json_error_item_not_found,
+		json_error_index_out_of_range
+	};
+
+	static JSON_INLINE
+		enum json_error_code json_error_code(const json_error_t *e)
+	{
+		return (enum json_error_code)e->text[JSON_ERROR_TEXT_LENGTH - 1];
+	}
+
 
 	/* getters, setters, manipulation */
 
@@ -268,16 +296,53 @@ extern "C" {
 	JANSSON_API int json_unpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt, ...);
 	JANSSON_API int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt, va_list ap);
 
+	/* precompiled pack/unpack formats */
+
+	typedef struct json_format_t json_format_t;
+
+	JANSSON_API json_format_t *json_pack_compile(const char *fmt);
+	JANSSON_API json_format_t *json_unpack_compile(const char *fmt);
+	JANSSON_API void json_format_free(json_format_t *format);
+
+	JANSSON_API json_t *json_pack_format(const json_format_t *format, ...);
+	JANSSON_API json_t *json_vpack_format_ex(json_error_t *error, size_t flags, const json_format_t *format, va_list ap);
+	JANSSON_API int json_unpack_format(json_t *root, const json_format_t *format, ...);
+	JANSSON_API int json_vunpack_format_ex(json_t *root, json_error_t *error, size_t flags, const json_format_t *format, va_list ap);
+
 
 	/* equality */
 
 	JANSSON_API int json_equal(json_t *value1, json_t *value2);
+	JANSSON_API size_t json_hash(json_t *value);
 
 
 	/* copying */
 
 	JANSSON_API json_t *json_copy(json_t *value);
 	JANSSON_API json_t *json_deep_copy(const json_t *value);
+	JANSSON_API json_t *json_cow_copy(json_t *value);
+
+
+	/* compiled JSON pointers (RFC 6901) */
+
+	typedef struct json_path json_path_t;
+
+	JANSSON_API json_path_t *json_path_compile(const char *pointer);
+	JANSSON_API void json_path_free(json_path_t *path);
+	JANSSON_API json_t *json_path_get(json_t *root, const json_path_t *path);
+
+	/* load filters, a set of JSON pointers or top level keys to keep */
+
+	typedef struct json_filter json_filter_t;
+
+	JANSSON_API json_filter_t *json_filter_create(const char **paths, size_t count);
+	JANSSON_API void json_filter_free(json_filter_t *filter);
+
+
+	/* JSON Patch (RFC 6902) */
+
+	JANSSON_API json_t *json_diff(json_t *old, json_t *new);
+	JANSSON_API json_t *json_patch_apply(json_t *doc, json_t *patch);
 
 
 	/* decoding */
@@ -287,6 +352,7 @@ extern "C" {
 #define JSON_DECODE_ANY         0x4
 #define JSON_DECODE_INT_AS_REAL 0x8
 #define JSON_ALLOW_NUL          0x10
+#define JSON_NO_DIAGNOSTICS     0x20  /* errors get a fixed text with no context */
 
 	typedef size_t(*json_load_callback_t)(void *buffer, size_t buflen, void *data);
 
@@ -297,6 +363,20 @@ extern "C" {
 	JANSSON_API json_t *json_load_file(const char *path, size_t flags, json_error_t *error);
 	JANSSON_API json_t *json_load_callback(json_load_callback_t callback, void *data, size_t flags, json_error_t *error);
 
+	/* Parse only the value a compiled path refers to, validating but skipping the
+	   rest.  The last of several equal keys wins, as with json_loads();
+	   JSON_REJECT_DUPLICATES only checks the keys along the path. */
+	JANSSON_API json_t *json_loads_path(const char *input, const json_path_t *path, size_t flags, json_error_t *error);
+	JANSSON_API json_t *json_loadb_path(const char *buffer, size_t buflen, const json_path_t *path, size_t flags, json_error_t *error);
+
+	/* Parse only the values a filter wants, validating but skipping the rest.
+	   Kept array elements stay at their index, skipped ones before them are null. */
+	JANSSON_API json_t *json_loads_filtered(const char *input, const json_filter_t *filter, size_t flags, json_error_t *error);
+	JANSSON_API json_t *json_loadb_filtered(const char *buffer, size_t buflen, const json_filter_t *filter, size_t flags, json_error_t *error);
+
+	/* Parse a large top level array on up to nthreads threads, 0 for one per processor */
+	JANSSON_API json_t *json_loadb_parallel(const char *buffer, size_t buflen, size_t nthreads, size_t flags, json_error_t *error);
+
 
 	/* encoding */
 
@@ -320,6 +400,35 @@ extern "C" {
 	JANSSON_API int json_dump_file(const json_t *json, const char *path, size_t flags);
 	JANSSON_API int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data, size_t flags);
 
+	/* MessagePack encoding and decoding, JSON_MEM values are stored as bin */
+
+	JANSSON_API char *json_msgpack_dumps(const json_t *json, size_t flags, size_t *size);
+	JANSSON_API size_t json_msgpack_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+	JANSSON_API int json_msgpack_dump_callback(const json_t *json, json_dump_callback_t callback, void *data, size_t flags);
+	JANSSON_API json_t *json_msgpack_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error);
+
+	/* Loads either JSON text or MessagePack, detected from the first byte */
+	JANSSON_API json_t *json_loadb_auto(const char *buffer, size_t buflen, size_t flags, json_error_t *error);
+
+	/* flattened read-only images, which can be mapped and read in place */
+
+	typedef struct json_image_node json_image_node_t;
+
+	JANSSON_API char *json_image_dumps(const json_t *json, size_t *size);
+	JANSSON_API size_t json_image_dumpb(const json_t *json, char *buffer, size_t size);
+	JANSSON_API const json_image_node_t *json_image_root(const void *image, size_t size);
+	JANSSON_API json_type json_image_typeof(const json_image_node_t *node);
+	JANSSON_API size_t json_image_size(const json_image_node_t *node);
+	JANSSON_API const json_image_node_t *json_image_array_get(const json_image_node_t *array, size_t index);
+	JANSSON_API const json_image_node_t *json_image_object_get(const json_image_node_t *object, const char *key);
+	JANSSON_API const char *json_image_object_key(const json_image_node_t *object, size_t index);
+	JANSSON_API const json_image_node_t *json_image_object_value(const json_image_node_t *object, size_t index);
+	JANSSON_API const char *json_image_string_value(const json_image_node_t *node);
+	JANSSON_API size_t json_image_string_length(const json_image_node_t *node);
+	JANSSON_API json_int_t json_image_integer_value(const json_image_node_t *node);
+	JANSSON_API double json_image_real_value(const json_image_node_t *node);
+	JANSSON_API json_t *json_image_load(const json_image_node_t *node);
+
 	/* custom memory allocation */
 
 	typedef void *(*json_malloc_t)(size_t);
@@ -328,6 +437,40 @@ extern "C" {
 	JANSSON_API void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn);
 	JANSSON_API void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn);
 
+	/* Extended allocation hooks.  malloc is passed the alignment the block
+	   needs, a power of two or 0 for the usual malloc alignment, and free is
+	   passed the size the block was allocated with, or 0 when it isn't known.
+	   Mem payloads are always allocated and freed with both.  Passing NULL
+	   restores the default malloc and free. */
+
+#define JSON_MEM_ALIGNMENT 64
+
+	typedef void *(*json_malloc_ex_t)(size_t size, size_t alignment);
+	typedef void(*json_free_ex_t)(void *ptr, size_t size);
+
+	JANSSON_API void json_set_alloc_funcs_ex(json_malloc_ex_t malloc_fn, json_free_ex_t free_fn);
+	JANSSON_API void json_get_alloc_funcs_ex(json_malloc_ex_t *malloc_fn, json_free_ex_t *free_fn);
+
+	/* Large page allocator, install with
+	   json_set_alloc_funcs_ex(json_large_malloc, json_large_free).  Aligned
+	   requests of at least the threshold are served from cached huge page
+	   mappings.  The threshold must not change while such blocks are live. */
+
+#define JSON_LARGE_ALLOC_DEFAULT_THRESHOLD ((size_t)2 << 20)
+
+	typedef struct json_large_alloc_stats_t {
+		size_t hits;          /* requests served from the cache */
+		size_t misses;        /* requests that needed a new mapping */
+		size_t bytes_mapped;  /* bytes currently mapped, cached ones too */
+		size_t bytes_cached;  /* bytes mapped but not in use */
+	} json_large_alloc_stats_t;
+
+	JANSSON_API void *json_large_malloc(size_t size, size_t alignment);
+	JANSSON_API void json_large_free(void *ptr, size_t size);
+	JANSSON_API void json_large_alloc_set_threshold(size_t threshold);
+	JANSSON_API void json_large_alloc_get_stats(json_large_alloc_stats_t *stats);
+	JANSSON_API void json_large_alloc_trim(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,10 +1,17 @@
 #include "jansson.h"
 #include "jansson_helper.h"
+#include "strbuffer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 /**
  * This function parses the given JSON string and converts it into a json_t object
  * @param json_string - a JSON character buffer that should be converted into a json_t
@@ -411,28 +418,20 @@ double get_double_options_from_json(json_t * root, const char * option_name, int
 	return get_double_options_inner(root, option_name, result, 0);
 }
 
-static int get_array_options_inner(const char * json_string, const char * option_name, size_t * count, char *** string_array, int ** int_array, int is_string_array)
+static int get_array_options_from_json_inner(json_t * root, const char * option_name, size_t * count, char *** string_array, int ** int_array, int is_string_array)
 {
-	json_t * root, *option_array, *option_item;
-	char ** option_strings;
-	int * option_ints;
-	size_t i;
-
-	root = get_root_option_json_object(json_string);
-	if (!root)
-		return -1;
+	json_t *option_array, *option_item;
+	char ** option_strings = NULL;
+	int * option_ints = NULL;
+	size_t i, j;
 
 	option_array = json_object_get(root, option_name);
 	if (!option_array)
-	{
-		json_decref(root);
 		return 0;
-	}
 
 	if (!json_is_array(option_array))
 	{
 		fprintf(stderr, "error: option item %s is expected to be a array\n", option_name);
-		json_decref(root);
 		return -1;
 	}
 
@@ -441,10 +440,9 @@ static int get_array_options_inner(const char * json_string, const char * option
 		option_strings = malloc(*count * sizeof(char *));
 	else
 		option_ints = malloc(*count * sizeof(int));
-	if ((is_string_array && !option_strings) || (!is_string_array && !option_ints))
+	if (*count && ((is_string_array && !option_strings) || (!is_string_array && !option_ints)))
 	{
 		fprintf(stderr, "error: couldn't allocate array for option %s (%zu items)\n", option_name, *count);
-		json_decref(root);
 		return -1;
 	}
 	for (i = 0; i < *count; i++)
@@ -453,8 +451,13 @@ static int get_array_options_inner(const char * json_string, const char * option
 		if ((is_string_array && !json_is_string(option_item)) || (!is_string_array && !json_is_integer(option_item)))
 		{
 			fprintf(stderr, "error: option %zu in array %s is expected to be a %s\n", i, option_name, is_string_array ? "string" : "integer");
-			json_decref(root);
+			if (is_string_array)
+			{
+				for (j = 0; j < i; j++)
+					free(option_strings[j]);
+			}
 			free(option_strings);
+			free(option_ints);
 			return -1;
 		}
 		if(is_string_array)
@@ -467,9 +470,20 @@ static int get_array_options_inner(const char * json_string, const char * option
 		*string_array = option_strings;
 	else
 		*int_array = option_ints;
+	return 1;
+}
+
+static int get_array_options_inner(const char * json_string, const char * option_name, size_t * count, char *** string_array, int ** int_array, int is_string_array)
+{
+	json_t * root;
+	int ret;
 
+	root = get_root_option_json_object(json_string);
+	if (!root)
+		return -1;
+	ret = get_array_options_from_json_inner(root, option_name, count, string_array, int_array, is_string_array);
 	json_decref(root);
-	return 1;
+	return ret;
 }
 
 
@@ -515,6 +529,270 @@ int * get_int_array_options(const char * json_string, const char * option_name,
 	return option_ints;
 }
 
+// The last options string handed to parse_options() on a thread and its parsed form.
+// The PARSE_OPTION_* macros call parse_options() once per option with the same string,
+// so this lets a module's create function parse its options only once.  The cache is
+// kept in thread specific storage, whose destructor frees it when the thread exits.
+typedef struct
+{
+	char * string;
+	json_t * root;
+} options_cache_t;
+
+static void options_cache_clear(options_cache_t * cache)
+{
+	free(cache->string);
+	json_decref(cache->root);
+	cache->string = NULL;
+	cache->root = NULL;
+}
+
+static void options_cache_free(void * data)
+{
+	options_cache_t * cache = (options_cache_t *)data;
+
+	if (!cache)
+		return;
+	options_cache_clear(cache);
+	free(cache);
+}
+
+// options_cache_lookup() finds the calling thread's cache, creating it if create is set
+#ifdef _WIN32
+static DWORD options_cache_key = FLS_OUT_OF_INDEXES;
+static INIT_ONCE options_cache_once = INIT_ONCE_STATIC_INIT;
+
+static VOID WINAPI options_cache_destructor(PVOID data)
+{
+	options_cache_free(data);
+}
+
+static BOOL CALLBACK options_cache_key_create(PINIT_ONCE once, PVOID param, PVOID * context)
+{
+	options_cache_key = FlsAlloc(options_cache_destructor);
+	return TRUE;
+}
+
+static options_cache_t * options_cache_lookup(int create)
+{
+	options_cache_t * cache;
+
+	InitOnceExecuteOnce(&options_cache_once, options_cache_key_create, NULL, NULL);
+	if (options_cache_key == FLS_OUT_OF_INDEXES)
+		return NULL;
+
+	cache = (options_cache_t *)FlsGetValue(options_cache_key);
+	if (!cache && create)
+	{
+		cache = (options_cache_t *)calloc(1, sizeof(options_cache_t));
+		if (cache && !FlsSetValue(options_cache_key, cache))
+		{
+			free(cache);
+			cache = NULL;
+		}
+	}
+	return cache;
+}
+#else
+static pthread_key_t options_cache_key;
+static pthread_once_t options_cache_once = PTHREAD_ONCE_INIT;
+static int options_cache_key_created = 0;
+
+static void options_cache_key_create(void)
+{
+	options_cache_key_created = !pthread_key_create(&options_cache_key, options_cache_free);
+}
+
+static options_cache_t * options_cache_lookup(int create)
+{
+	options_cache_t * cache;
+
+	pthread_once(&options_cache_once, options_cache_key_create);
+	if (!options_cache_key_created)
+		return NULL;
+
+	cache = (options_cache_t *)pthread_getspecific(options_cache_key);
+	if (!cache && create)
+	{
+		cache = (options_cache_t *)calloc(1, sizeof(options_cache_t));
+		if (cache && pthread_setspecific(options_cache_key, cache))
+		{
+			free(cache);
+			cache = NULL;
+		}
+	}
+	return cache;
+}
+#endif
+
+static int parse_option_item(json_t * root, const option_schema_t * entry, void * dest)
+{
+	json_t * option_item;
+	char * field = (char *)dest + entry->offset;
+	char ** string_array = NULL;
+	int * int_array = NULL;
+	size_t count = 0;
+	int result;
+
+	if (entry->type == OPTION_STRING_ARRAY || entry->type == OPTION_INT_ARRAY)
+	{
+		result = get_array_options_from_json_inner(root, entry->name, &count,
+			&string_array, &int_array, entry->type == OPTION_STRING_ARRAY);
+		if (result > 0)
+		{
+			if (entry->type == OPTION_STRING_ARRAY)
+				*(char ***)field = string_array;
+			else
+				*(int **)field = int_array;
+			*(size_t *)((char *)dest + entry->count_offset) = count;
+		}
+		return result;
+	}
+
+	option_item = json_object_get(root, entry->name);
+	if (!option_item)
+		return 0;
+
+	switch (entry->type)
+	{
+	case OPTION_INT:
+	case OPTION_UINT64T:
+		if (!json_is_integer(option_item))
+		{
+			fprintf(stderr, "error: option item %s is expected to be an integer\n", entry->name);
+			return -1;
+		}
+		if (entry->type == OPTION_INT)
+			*(int *)field = (int)json_integer_value(option_item);
+		else
+			*(uint64_t *)field = (uint64_t)json_integer_value(option_item);
+		return 1;
+	case OPTION_DOUBLE:
+		if (!json_is_real(option_item))
+		{
+			fprintf(stderr, "error: option item %s is expected to be a real\n", entry->name);
+			return -1;
+		}
+		*(double *)field = json_real_value(option_item);
+		return 1;
+	case OPTION_STRING:
+		if (!json_is_string(option_item))
+		{
+			fprintf(stderr, "error: option item %s is expected to be a string\n", entry->name);
+			return -1;
+		}
+		free(*(char **)field);
+		*(char **)field = strdup(json_string_value(option_item));
+		return 1;
+	default:
+		fprintf(stderr, "error: option item %s has an unknown schema type %d\n", entry->name, entry->type);
+		return -1;
+	}
+}
+
+/**
+ * Fills in a struct from a json_t object, as described by an option schema.  Every
+ * entry in the schema is checked, so all of the malformed options are reported rather
+ * than just the first one.
+ * @param root - the json_t object to get the attributes from
+ * @param schema - an array of option_schema_t entries describing each option and the
+ * field of dest that it is stored in
+ * @param schema_count - the number of entries in the schema array
+ * @param dest - a pointer to the struct to fill in.  Fields for options that aren't found
+ * are left untouched.  String fields that are set have their previous value freed.
+ * @param results - optionally, an array of schema_count integers used to return the result
+ * for each option: 0 if the option wasn't found, -1 if it was found but the wrong type, and
+ * 1 if it was found and stored in dest.  May be NULL.
+ * @return - 0 on success, or -1 if any option was the wrong type or a required option was missing
+ */
+int parse_options_from_json(json_t * root, const option_schema_t * schema, size_t schema_count, void * dest, int * results)
+{
+	size_t i;
+	int result, ret = 0;
+
+	for (i = 0; i < schema_count; i++)
+	{
+		result = parse_option_item(root, &schema[i], dest);
+		if (result == 0 && schema[i].required)
+		{
+			fprintf(stderr, "error: required option item %s is missing\n", schema[i].name);
+			ret = -1;
+		}
+		else if (result < 0)
+			ret = -1;
+		if (results)
+			results[i] = result;
+	}
+	return ret;
+}
+
+/**
+ * Fills in a struct from a JSON string, as described by an option schema.  The JSON string
+ * is only parsed once, and the parsed form of the most recent string is kept so that
+ * repeated calls with the same options (such as from the PARSE_OPTION_* macros) don't
+ * parse it again.
+ * @param options - the JSON string to parse and obtain the attribute values from
+ * @param schema - an array of option_schema_t entries describing each option
+ * @param schema_count - the number of entries in the schema array
+ * @param dest - a pointer to the struct to fill in
+ * @param results - optionally, an array of schema_count integers used to return the
+ * result for each option, as in parse_options_from_json.  May be NULL.
+ * @return - 0 on success, or -1 if the options couldn't be parsed, any option was the wrong
+ * type, or a required option was missing
+ */
+int parse_options(const char * options, const option_schema_t * schema, size_t schema_count, void * dest, int * results)
+{
+	options_cache_t * cache = NULL;
+	json_t * root = NULL;
+	char * options_copy;
+	size_t i;
+	int ret;
+
+	if (options)
+	{
+		cache = options_cache_lookup(1);
+		if (cache && cache->string && !strcmp(cache->string, options))
+			return parse_options_from_json(cache->root, schema, schema_count, dest, results);
+		root = get_root_option_json_object(options);
+	}
+
+	if (!root)
+	{
+		if (results)
+		{
+			for (i = 0; i < schema_count; i++)
+				results[i] = -1;
+		}
+		return -1;
+	}
+
+	ret = parse_options_from_json(root, schema, schema_count, dest, results);
+
+	// Without a cache, or the memory to fill it, the options are just parsed again next time
+	options_copy = cache ? strdup(options) : NULL;
+	if (options_copy)
+	{
+		options_cache_clear(cache);
+		cache->string = options_copy;
+		cache->root = root;
+	}
+	else
+		json_decref(root);
+	return ret;
+}
+
+/**
+ * Frees the parsed options kept by parse_options() for the calling thread.  This happens
+ * automatically when the thread exits, so it's only needed to release the memory earlier.
+ */
+void clear_parse_options_cache(void)
+{
+	options_cache_t * cache = options_cache_lookup(0);
+
+	if (cache)
+		options_cache_clear(cache);
+}
+
 /**
  * Adds a new attribute to an existing json string.
  * @param root_options - the JSON string to parse and add an attribute to
@@ -528,22 +806,26 @@ int * get_int_array_options(const char * json_string, const char * option_name,
  */
 static char * add_option_to_json(const char * root_options, const char * new_option_name, const char * new_value_string, int new_value_int)
 {
-	json_t * root, *temp;
-	char * ret;
+	options_builder_t * builder;
+	char * ret = NULL;
+	int err;
 
-	root = get_root_option_json_object(root_options);
-	if (!root)
+	if (!root_options)
+		return NULL;
+
+	builder = options_builder_create(root_options);
+	if (!builder)
 		return NULL;
 
 	//Add the new item
-	if (new_value_string) {
-		ADD_STRING(temp, new_value_string, root, new_option_name);
-	} else {
-		ADD_INT(temp, new_value_int, root, new_option_name);
-	}
+	if (new_value_string)
+		err = options_builder_set_string(builder, new_option_name, new_value_string);
+	else
+		err = options_builder_set_int(builder, new_option_name, new_value_int);
 
-	ret = json_dumps(root, 0);
-	json_decref(root);
+	if (!err)
+		ret = options_builder_dump(builder);
+	options_builder_free(builder);
 	return ret;
 }
 
@@ -575,6 +857,345 @@ char * add_int_option_to_json(const char * root_options, const char * new_option
 	return add_option_to_json(root_options, new_option_name, NULL, new_value);
 }
 
+struct options_builder
+{
+	json_t * root;          //the options, or with a base, the options set on top of it
+	const json_t * base;    //the borrowed base options, or NULL
+	json_t * deleted;       //with a base, the base options that were removed, as keys
+};
+
+static options_builder_t * options_builder_wrap(json_t * root, const json_t * base)
+{
+	options_builder_t * builder;
+
+	if (!root)
+		return NULL;
+	builder = malloc(sizeof(options_builder_t));
+	if (!builder)
+	{
+		json_decref(root);
+		return NULL;
+	}
+	builder->root = root;
+	builder->base = base;
+	builder->deleted = NULL;
+	if (base)
+	{
+		builder->deleted = json_object();
+		if (!builder->deleted)
+		{
+			options_builder_free(builder);
+			return NULL;
+		}
+	}
+	return builder;
+}
+
+/**
+ * Creates an options builder, which allows any number of options to be set, deleted,
+ * or merged into a JSON options string while only parsing and dumping it once.
+ * @param options - the JSON string to start from, or NULL to start with no options
+ * @return - a new options builder on success, or NULL on failure.  The builder should be
+ * freed with options_builder_free.
+ */
+options_builder_t * options_builder_create(const char * options)
+{
+	if (!options)
+		return options_builder_wrap(json_object(), NULL);
+	return options_builder_wrap(get_root_option_json_object(options), NULL);
+}
+
+/**
+ * Creates an options builder that starts from an already parsed set of options.  The base
+ * isn't copied.  The builder keeps the options that are set or deleted on top of it, and
+ * only combines the two when it's dumped.  The base is only ever read, so several threads
+ * may build from the same base at once.
+ * @param base - the json_t object holding the base options.  It must stay valid and
+ * unchanged until the builder is freed.
+ * @return - a new options builder on success, or NULL on failure.  The builder should be
+ * freed with options_builder_free.
+ */
+options_builder_t * options_builder_create_from_json(const json_t * base)
+{
+	if (!json_is_object(base))
+		return NULL;
+	return options_builder_wrap(json_object(), base);
+}
+
+/**
+ * Frees an options builder
+ * @param builder - the options builder to free
+ */
+void options_builder_free(options_builder_t * builder)
+{
+	if (!builder)
+		return;
+	json_decref(builder->root);
+	json_decref(builder->deleted);
+	free(builder);
+}
+
+/**
+ * Gets the current value of an option, from the options set on the builder or else the base
+ * @return - a borrowed reference to the value, or NULL if the option isn't set
+ */
+static json_t * options_builder_get(options_builder_t * builder, const char * option_name)
+{
+	json_t * value = json_object_get(builder->root, option_name);
+
+	if (value || !builder->base || json_object_get(builder->deleted, option_name))
+		return value;
+	return json_object_get(builder->base, option_name);
+}
+
+/**
+ * Sets an option to a json_t value.  Any existing value for the option is replaced.
+ * @param builder - the options builder to modify
+ * @param option_name - the name of the option to set
+ * @param value - the value to give the option.  The builder takes its own reference, so
+ * the caller still owns value.
+ * @return - non-zero on failure, 0 on success
+ */
+int options_builder_set(options_builder_t * builder, const char * option_name, json_t * value)
+{
+	if (!builder || !option_name || !value)
+		return 1;
+	if (json_object_set(builder->root, option_name, value))
+		return 1;
+	if (builder->deleted)
+		json_object_del(builder->deleted, option_name);
+	return 0;
+}
+
+static int options_builder_set_new(options_builder_t * builder, const char * option_name, json_t * value)
+{
+	int ret;
+
+	ret = options_builder_set(builder, option_name, value);
+	json_decref(value);
+	return ret;
+}
+
+/**
+ * Sets an option to a string value
+ * @param builder - the options builder to modify
+ * @param option_name - the name of the option to set
+ * @param value - the option's new value
+ * @return - non-zero on failure, 0 on success
+ */
+int options_builder_set_string(options_builder_t * builder, const char * option_name, const char * value)
+{
+	if (!value)
+		return 1;
+	return options_builder_set_new(builder, option_name, json_string(value));
+}
+
+/**
+ * Sets an option to an integer value
+ * @param builder - the options builder to modify
+ * @param option_name - the name of the option to set
+ * @param value - the option's new value
+ * @return - non-zero on failure, 0 on success
+ */
+int options_builder_set_int(options_builder_t * builder, const char * option_name, long long value)
+{
+	return options_builder_set_new(builder, option_name, json_integer(value));
+}
+
+/**
+ * Sets an option to a real value
+ * @param builder - the options builder to modify
+ * @param option_name - the name of the option to set
+ * @param value - the option's new value
+ * @return - non-zero on failure, 0 on success
+ */
+int options_builder_set_double(options_builder_t * builder, const char * option_name, double value)
+{
+	return options_builder_set_new(builder, option_name, json_real(value));
+}
+
+/**
+ * Removes an option
+ * @param builder - the options builder to modify
+ * @param option_name - the name of the option to remove
+ * @return - 0 if the option was removed, or non-zero if it wasn't set
+ */
+int options_builder_delete(options_builder_t * builder, const char * option_name)
+{
+	int removed;
+
+	if (!builder || !option_name)
+		return 1;
+
+	removed = !json_object_del(builder->root, option_name);
+	if (builder->base && json_object_get(builder->base, option_name)
+		&& !json_object_get(builder->deleted, option_name))
+	{
+		if (json_object_set_new(builder->deleted, option_name, json_null()))
+			return 1;
+		removed = 1;
+	}
+	return !removed;
+}
+
+/**
+ * Merges the options in a json_t object into the builder.  Options that are set in both
+ * are given the value from the merged object.
+ * @param builder - the options builder to modify
+ * @param options - the json_t object holding the options to merge in
+ * @return - non-zero on failure, 0 on success
+ */
+int options_builder_merge_json(options_builder_t * builder, json_t * options)
+{
+	const char * key;
+	json_t * value;
+
+	if (!builder || !json_is_object(options))
+		return 1;
+	json_object_foreach(options, key, value)
+	{
+		if (options_builder_set(builder, key, value))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Merges the options in a JSON string into the builder.  Options that are set in both
+ * are given the value from the merged string.
+ * @param builder - the options builder to modify
+ * @param options - the JSON string holding the options to merge in
+ * @return - non-zero on failure, 0 on success
+ */
+int options_builder_merge(options_builder_t * builder, const char * options)
+{
+	json_t * root;
+	int ret;
+
+	root = get_root_option_json_object(options);
+	if (!root)
+		return 1;
+	ret = options_builder_merge_json(builder, root);
+	json_decref(root);
+	return ret;
+}
+
+/**
+ * Gets the options held by an options builder, without serializing them.  A builder with a
+ * base copies the base options it still uses the first time this is called, and from then
+ * on works on the returned object directly.
+ * @param builder - the options builder to get the options from
+ * @return - NULL on error, or a borrowed reference to the builder's options object, valid
+ * until the builder is freed
+ */
+json_t * options_builder_json(options_builder_t * builder)
+{
+	const char * key;
+	json_t * value, * options;
+
+	if (!builder)
+		return NULL;
+	if (!builder->base)
+		return builder->root;
+
+	options = json_object();
+	if (!options)
+		return NULL;
+	json_object_foreach((json_t *)builder->base, key, value)
+	{
+		value = options_builder_get(builder, key);
+		if (value && json_object_set_new(options, key,
+			value == json_object_get(builder->root, key) ? json_incref(value) : json_deep_copy(value)))
+		{
+			json_decref(options);
+			return NULL;
+		}
+	}
+	json_object_foreach(builder->root, key, value)
+	{
+		if (!json_object_get(builder->base, key) && json_object_set(options, key, value))
+		{
+			json_decref(options);
+			return NULL;
+		}
+	}
+
+	json_decref(builder->root);
+	json_decref(builder->deleted);
+	builder->root = options;
+	builder->base = NULL;
+	builder->deleted = NULL;
+	return options;
+}
+
+static int options_builder_dump_callback(const char * buffer, size_t size, void * data)
+{
+	return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
+}
+
+/**
+ * Appends one option to a dump in progress, in the same format json_dumps uses
+ */
+static int options_builder_dump_option(strbuffer_t * output, const char * option_name, json_t * value)
+{
+	json_t * key;
+	int ret;
+
+	key = json_string_nocheck(option_name);
+	if (!key)
+		return 1;
+	ret = (output->length > 1 && strbuffer_append_bytes(output, ", ", 2))
+		|| json_dump_callback(key, options_builder_dump_callback, output, JSON_ENCODE_ANY)
+		|| strbuffer_append_bytes(output, ": ", 2)
+		|| json_dump_callback(value, options_builder_dump_callback, output, JSON_ENCODE_ANY);
+	json_decref(key);
+	return ret;
+}
+
+/**
+ * Serializes the options held by an options builder.  With a base, the base options are
+ * written in their original order with any new values in place, followed by the options that
+ * only the builder sets.
+ * @param builder - the options builder to serialize
+ * @return - NULL on error, or the JSON string of the builder's options.  The return value
+ * should be freed by the caller.
+ */
+char * options_builder_dump(options_builder_t * builder)
+{
+	strbuffer_t output;
+	const char * key;
+	json_t * value;
+	int failed = 0;
+
+	if (!builder)
+		return NULL;
+	if (!builder->base)
+		return json_dumps(builder->root, 0);
+
+	if (strbuffer_init(&output))
+		return NULL;
+	failed = strbuffer_append_byte(&output, '{');
+	json_object_foreach((json_t *)builder->base, key, value)
+	{
+		value = options_builder_get(builder, key);
+		if (!failed && value)
+			failed = options_builder_dump_option(&output, key, value);
+	}
+	json_object_foreach(builder->root, key, value)
+	{
+		if (!failed && !json_object_get(builder->base, key))
+			failed = options_builder_dump_option(&output, key, value);
+	}
+	failed = failed || strbuffer_append_byte(&output, '}');
+
+	if (failed)
+	{
+		strbuffer_close(&output);
+		return NULL;
+	}
+	return strbuffer_steal_value(&output);
+}
+
 /**
  * Gets an array of buffers out of a JSON string containing an array of
  * JSON mem items
@@ -595,7 +1216,7 @@ int decode_mem_array(const char *json_string, char *** items, size_t ** item_len
 	char ** items_array;
 	size_t * items_lengths_array;
 
-	items_jsons = json_loads(json_string, 0, &error);
+	items_jsons = json_loads(json_string, JSON_NO_DIAGNOSTICS, &error);
 	if (!items_jsons)
 		return 1;
 
@@ -2,117 +2,137 @@
 
 #include "jansson.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Some macros to make parsing options easier
-
-#define PARSE_OPTION_INT_TEMP(state, options, name, name_literal, fail_func, temp_name)  \
-	int result_##temp_name = 0;                                                          \
-	int tempi_##temp_name = get_int_options(options, name_literal, &result_##temp_name); \
-	if (result_##temp_name < 0)                                                          \
-	{                                                                                    \
-		fail_func(state);                                                                \
-		return NULL;                                                                     \
-	}                                                                                    \
-	else if (result_##temp_name > 0)                                                     \
-	{                                                                                    \
-		state->name = tempi_##temp_name;                                                 \
+// Declarative option parsing.  Describe the options of a module with a table
+// of OPTION_SCHEMA entries and fill the whole struct with a single parse:
+//
+//   static const option_schema_t my_options[] = {
+//       OPTION_SCHEMA(my_state_t, num_rounds, "num_rounds", OPTION_INT, 0),
+//       OPTION_SCHEMA(my_state_t, path, "path", OPTION_STRING, 1),
+//       OPTION_SCHEMA_ARRAY(my_state_t, names, num_names, "names", OPTION_STRING_ARRAY, 0),
+//   };
+//   if (parse_options(options, my_options, ARRAY_SIZE(my_options), state, NULL)) ...
+
+enum OPTION_TYPE {
+	OPTION_INT,          // int
+	OPTION_UINT64T,      // uint64_t
+	OPTION_DOUBLE,       // double, the JSON value must be a real
+	OPTION_STRING,       // char *, the old value is freed when replaced
+	OPTION_STRING_ARRAY, // char **, with a size_t count
+	OPTION_INT_ARRAY,    // int *, with a size_t count
+};
+
+typedef struct option_schema
+{
+	const char * name;
+	enum OPTION_TYPE type;
+	size_t offset;       // offset of the field in the destination struct
+	size_t count_offset; // offset of the size_t item count, for array types only
+	int required;
+} option_schema_t;
+
+#define OPTION_SCHEMA(type, field, name_literal, option_type, required) \
+	{ name_literal, option_type, offsetof(type, field), 0, required }
+#define OPTION_SCHEMA_ARRAY(type, field, count_field, name_literal, option_type, required) \
+	{ name_literal, option_type, offsetof(type, field), offsetof(type, count_field), required }
+
+// Temporary storage used by the PARSE_OPTION_*_ARRAY macros
+typedef struct option_array_value
+{
+	void * items;
+	size_t count;
+} option_array_value_t;
+
+// Some macros to make parsing options easier.  Each one is a single entry schema
+// parsed into a temporary, so repeated uses with the same options string only
+// parse it once.
+
+#define PARSE_OPTION_VALUE_TEMP(state, options, name, name_literal, fail_func, temp_name, option_type, temp_type) \
+	int result_##temp_name = 0;                                                                                \
+	temp_type temp_##temp_name = 0;                                                                            \
+	const option_schema_t schema_##temp_name = { name_literal, option_type, 0, 0, 0 };                         \
+	if (parse_options(options, &schema_##temp_name, 1, &temp_##temp_name, &result_##temp_name))               \
+	{                                                                                                          \
+		fail_func(state);                                                                                      \
+		return NULL;                                                                                           \
+	}                                                                                                          \
+	else if (result_##temp_name > 0)                                                                           \
+	{                                                                                                          \
+		state->name = temp_##temp_name;                                                                        \
 	}
 
-#define PARSE_OPTION_INT(state, options, name, name_literal, fail_func)                  \
+#define PARSE_OPTION_INT_TEMP(state, options, name, name_literal, fail_func, temp_name)                    \
+	PARSE_OPTION_VALUE_TEMP(state, options, name, name_literal, fail_func, temp_name, OPTION_INT, int)
+
+#define PARSE_OPTION_INT(state, options, name, name_literal, fail_func)                                    \
 	PARSE_OPTION_INT_TEMP(state, options, name, name_literal, fail_func, name)
 
-#define PARSE_OPTION_UINT64T_TEMP(state, options, name, name_literal, fail_func, temp_name)       \
-	int result_##temp_name = 0;                                                                   \
-	uint64_t tempi_##temp_name = get_uint64t_options(options, name_literal, &result_##temp_name); \
-	if (result_##temp_name < 0)                                                                   \
-	{                                                                                             \
-		fail_func(state);                                                                         \
-		return NULL;                                                                              \
-	}                                                                                             \
-	else if (result_##temp_name > 0)                                                              \
-	{                                                                                             \
-		state->name = tempi_##temp_name;                                                          \
-	}
+#define PARSE_OPTION_UINT64T_TEMP(state, options, name, name_literal, fail_func, temp_name)                \
+	PARSE_OPTION_VALUE_TEMP(state, options, name, name_literal, fail_func, temp_name, OPTION_UINT64T, uint64_t)
 
-#define PARSE_OPTION_UINT64T(state, options, name, name_literal, fail_func)                       \
+#define PARSE_OPTION_UINT64T(state, options, name, name_literal, fail_func)                                \
 	PARSE_OPTION_UINT64T_TEMP(state, options, name, name_literal, fail_func, name)
 
-#define PARSE_OPTION_DOUBLE_TEMP(state, options, name, name_literal, fail_func, temp_name)     \
-	int result_##temp_name = 0;                                                                \
-	double tempi_##temp_name = get_double_options(options, name_literal, &result_##temp_name); \
-	if (result_##temp_name < 0)                                                                \
-	{                                                                                          \
-		fail_func(state);                                                                      \
-		return NULL;                                                                           \
-	}                                                                                          \
-	else if (result_##temp_name > 0)                                                           \
-	{                                                                                          \
-		state->name = tempi_##temp_name;                                                       \
-	}
+#define PARSE_OPTION_DOUBLE_TEMP(state, options, name, name_literal, fail_func, temp_name)                 \
+	PARSE_OPTION_VALUE_TEMP(state, options, name, name_literal, fail_func, temp_name, OPTION_DOUBLE, double)
 
-#define PARSE_OPTION_DOUBLE(state, options, name, name_literal, fail_func)                     \
+#define PARSE_OPTION_DOUBLE(state, options, name, name_literal, fail_func)                                 \
 	PARSE_OPTION_DOUBLE_TEMP(state, options, name, name_literal, fail_func, name)
 
-#define PARSE_OPTION_STRING_TEMP(state, options, name, name_literal, fail_func, temp_name)     \
-	int result_##temp_name = 0;                                                                \
-	char * temps_##temp_name = get_string_options(options, name_literal, &result_##temp_name); \
-	if (result_##temp_name < 0)                                                                \
-	{                                                                                          \
-		fail_func(state);                                                                      \
-		return NULL;                                                                           \
-	}                                                                                          \
-	else if (result_##temp_name > 0)                                                           \
-	{                                                                                          \
-		if(state->name)                                                                        \
-			free(state->name);                                                                 \
-		state->name = temps_##temp_name;                                                       \
+#define PARSE_OPTION_STRING_TEMP(state, options, name, name_literal, fail_func, temp_name)                 \
+	int result_##temp_name = 0;                                                                            \
+	char * temps_##temp_name = NULL;                                                                       \
+	const option_schema_t schema_##temp_name = { name_literal, OPTION_STRING, 0, 0, 0 };                   \
+	if (parse_options(options, &schema_##temp_name, 1, &temps_##temp_name, &result_##temp_name))           \
+	{                                                                                                      \
+		fail_func(state);                                                                                  \
+		return NULL;                                                                                       \
+	}                                                                                                      \
+	else if (result_##temp_name > 0)                                                                       \
+	{                                                                                                      \
+		if(state->name)                                                                                    \
+			free(state->name);                                                                             \
+		state->name = temps_##temp_name;                                                                   \
 	}
 
-#define PARSE_OPTION_STRING(state, options, name, name_literal, fail_func)                     \
+#define PARSE_OPTION_STRING(state, options, name, name_literal, fail_func)                                 \
 	PARSE_OPTION_STRING_TEMP(state, options, name, name_literal, fail_func, name)
 
-#define PARSE_OPTION_ARRAY_TEMP(state, options, name, count, name_literal, fail_func, temp_name)                   \
-	int result_##temp_name = 0;                                                                                    \
-	size_t count_##temp_name = 0;                                                                                  \
-	char ** temps_##temp_name = get_array_options(options, name_literal, &count_##temp_name, &result_##temp_name); \
-	if (result_##temp_name < 0)                                                                                    \
-	{                                                                                                              \
-		fail_func(state);                                                                                          \
-		return NULL;                                                                                               \
-	}                                                                                                              \
-	else if (result_##temp_name > 0)                                                                               \
-	{                                                                                                              \
-		if(state->name)                                                                                            \
-			free(state->name);                                                                                     \
-		state->name = temps_##temp_name;                                                                           \
-		state->count = count_##temp_name;                                                                          \
-	}                            
-
-#define PARSE_OPTION_ARRAY(state, options, name, count, name_literal, fail_func)                                   \
-	PARSE_OPTION_ARRAY_TEMP(state, options, name, count, name_literal, fail_func, name)
-
-#define PARSE_OPTION_INT_ARRAY_TEMP(state, options, name, count, name_literal, fail_func, temp_name)                 \
-	int result_##temp_name = 0;                                                                                      \
-	size_t count_##temp_name = 0;                                                                                    \
-	int * temps_##temp_name = get_int_array_options(options, name_literal, &count_##temp_name, &result_##temp_name); \
-	if (result_##temp_name < 0)                                                                                      \
-	{                                                                                                                \
-		fail_func(state);                                                                                            \
-		return NULL;                                                                                                 \
-	}                                                                                                                \
-	else if (result_##temp_name > 0)                                                                                 \
-	{                                                                                                                \
-		if(state->name)                                                                                              \
-			free(state->name);                                                                                       \
-		state->name = temps_##temp_name;                                                                             \
-		state->count = count_##temp_name;                                                                            \
+#define PARSE_OPTION_ARRAY_VALUE_TEMP(state, options, name, count_field, name_literal, fail_func, temp_name, option_type) \
+	int result_##temp_name = 0;                                                                                     \
+	option_array_value_t temps_##temp_name = { NULL, 0 };                                                           \
+	const option_schema_t schema_##temp_name = { name_literal, option_type,                                         \
+		offsetof(option_array_value_t, items), offsetof(option_array_value_t, count), 0 };                          \
+	if (parse_options(options, &schema_##temp_name, 1, &temps_##temp_name, &result_##temp_name))                    \
+	{                                                                                                               \
+		fail_func(state);                                                                                           \
+		return NULL;                                                                                                \
+	}                                                                                                               \
+	else if (result_##temp_name > 0)                                                                                \
+	{                                                                                                               \
+		if(state->name)                                                                                             \
+			free(state->name);                                                                                      \
+		state->name = temps_##temp_name.items;                                                                      \
+		state->count_field = temps_##temp_name.count;                                                                     \
 	}
 
-#define PARSE_OPTION_INT_ARRAY(state, options, name, count, name_literal, fail_func)                                 \
-	PARSE_OPTION_INT_ARRAY_TEMP(state, options, name, count, name_literal, fail_func, name)
+#define PARSE_OPTION_ARRAY_TEMP(state, options, name, count_field, name_literal, fail_func, temp_name)                    \
+	PARSE_OPTION_ARRAY_VALUE_TEMP(state, options, name, count_field, name_literal, fail_func, temp_name, OPTION_STRING_ARRAY)
+
+#define PARSE_OPTION_ARRAY(state, options, name, count_field, name_literal, fail_func)                                    \
+	PARSE_OPTION_ARRAY_TEMP(state, options, name, count_field, name_literal, fail_func, name)
+
+#define PARSE_OPTION_INT_ARRAY_TEMP(state, options, name, count_field, name_literal, fail_func, temp_name)                \
+	PARSE_OPTION_ARRAY_VALUE_TEMP(state, options, name, count_field, name_literal, fail_func, temp_name, OPTION_INT_ARRAY)
+
+#define PARSE_OPTION_INT_ARRAY(state, options, name, count_field, name_literal, fail_func)                                \
+	PARSE_OPTION_INT_ARRAY_TEMP(state, options, name, count_field, name_literal, fail_func, name)
 
 
 // Some macros to make iterating json arrays easier
@@ -198,9 +218,27 @@ JANSSON_API int * get_int_array_options(const char * json_string, const char * o
 
 JANSSON_API json_t * get_root_option_json_object(const char * options);
 
+JANSSON_API int parse_options(const char * options, const option_schema_t * schema, size_t schema_count, void * dest, int * results);
+JANSSON_API int parse_options_from_json(json_t * root, const option_schema_t * schema, size_t schema_count, void * dest, int * results);
+JANSSON_API void clear_parse_options_cache(void);
+
 JANSSON_API char * add_string_option_to_json(const char * root_options, const char * new_option_name, const char * new_value);
 JANSSON_API char * add_int_option_to_json(const char * root_options, const char * new_option_name, int new_value);
 
+typedef struct options_builder options_builder_t;
+JANSSON_API options_builder_t * options_builder_create(const char * options);
+JANSSON_API options_builder_t * options_builder_create_from_json(const json_t * base);
+JANSSON_API void options_builder_free(options_builder_t * builder);
+JANSSON_API int options_builder_set(options_builder_t * builder, const char * option_name, json_t * value);
+JANSSON_API int options_builder_set_string(options_builder_t * builder, const char * option_name, const char * value);
+JANSSON_API int options_builder_set_int(options_builder_t * builder, const char * option_name, long long value);
+JANSSON_API int options_builder_set_double(options_builder_t * builder, const char * option_name, double value);
+JANSSON_API int options_builder_delete(options_builder_t * builder, const char * option_name);
+JANSSON_API int options_builder_merge(options_builder_t * builder, const char * options);
+JANSSON_API int options_builder_merge_json(options_builder_t * builder, json_t * options);
+JANSSON_API json_t * options_builder_json(options_builder_t * builder);
+JANSSON_API char * options_builder_dump(options_builder_t * builder);
+
 JANSSON_API int decode_mem_array(const char *json_string, char *** items, size_t ** item_lengths, size_t * items_count);
 JANSSON_API char * encode_mem_array(char ** items, size_t * item_lengths, size_t items_count, int * output_length);
 
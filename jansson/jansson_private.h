@@ -35,10 +35,15 @@
 #endif
 #endif
 
+/* hash caches json_hash() and is only valid while hash_epoch matches the
+   current write epoch, which json_hash() also stamps on the scalars it
+   visits. */
 typedef struct {
     json_t json;
     hashtable_t hashtable;
     int visited;
+    size_t hash;
+    size_t hash_epoch;
 } json_object_t;
 
 typedef struct {
@@ -47,12 +52,15 @@ typedef struct {
     size_t entries;
     json_t **table;
     int visited;
+    size_t hash;
+    size_t hash_epoch;
 } json_array_t;
 
 typedef struct {
     json_t json;
     char *value;
     size_t length;
+    size_t hash_epoch;
 } json_string_t;
 
 typedef struct {
@@ -64,11 +72,13 @@ typedef struct {
 typedef struct {
     json_t json;
     double value;
+    size_t hash_epoch;
 } json_real_t;
 
 typedef struct {
     json_t json;
     json_int_t value;
+    size_t hash_epoch;
 } json_integer_t;
 
 #define json_to_object(json_)  container_of(json_, json_object_t, json)
@@ -81,9 +91,57 @@ typedef struct {
 /* Create a string by taking ownership of an existing buffer */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len);
 
-/* Create a mem object by taking ownership of an existing buffer */
+/* Create a mem object by taking ownership of an existing buffer, which
+   must come from jsonp_malloc_aligned(len, JSON_MEM_ALIGNMENT) */
 json_t *json_mem_own(const char *value, size_t len);
 
+/* json_object_get() with the key's jsonp_hash_bytes() hash already known */
+json_t *jsonp_object_get_hashed(const json_t *object, const char *key, size_t hash);
+
+/* Seeded hash of a byte buffer, the same one used for object keys */
+size_t jsonp_hash_bytes(const void *data, size_t length);
+
+/* Unseeded hash of a byte buffer, stable across processes */
+uint32_t jsonp_hash_bytes_fixed(const void *data, size_t length);
+
+/* A compiled JSON pointer.  Every reference token keeps its unescaped key
+   and hash for object lookups, and its index if it is a valid array index. */
+typedef struct {
+    const char *key;
+    size_t length;
+    size_t hash;
+    size_t index;
+    int is_index;
+} json_path_token_t;
+
+struct json_path {
+    size_t count;
+    json_path_token_t tokens[1];
+};
+
+/* A load filter is a trie of the wanted paths.  A node with keep set wants
+   its whole value, otherwise only its children are kept. */
+typedef struct json_filter_node {
+    json_path_token_t token;
+    int keep;
+    size_t count;
+    struct json_filter_node *children;
+} json_filter_node_t;
+
+struct json_filter {
+    json_filter_node_t root;
+    size_t path_count;
+    json_path_t **paths;
+};
+
+const json_filter_node_t *jsonp_filter_child(const json_filter_node_t *node,
+                                             const char *key, size_t length);
+const json_filter_node_t *jsonp_filter_index(const json_filter_node_t *node, size_t index);
+
+/* Parses the elements of an array without its brackets, see load.c */
+int jsonp_loadb_elements(const char *buffer, size_t buflen, size_t flags,
+                         json_t *array, json_error_t *error);
+
 /* Error message formatting */
 void jsonp_error_init(json_error_t *error, const char *source);
 void jsonp_error_set_source(json_error_t *error, const char *source);
@@ -91,6 +149,10 @@ void jsonp_error_set(json_error_t *error, int line, int column,
                      size_t position, const char *msg, ...);
 void jsonp_error_vset(json_error_t *error, int line, int column,
                       size_t position, const char *msg, va_list ap);
+void jsonp_error_set_text(json_error_t *error, int line, int column,
+                          size_t position, enum json_error_code code,
+                          const char *text);
+const char *jsonp_error_code_text(enum json_error_code code);
 
 /* Locale independent string<->double conversions */
 int jsonp_strtod(strbuffer_t *strbuffer, double *out);
@@ -103,6 +165,12 @@ char *jsonp_strndup(const char *str, size_t length);
 char *jsonp_strdup(const char *str);
 char *jsonp_strndup(const char *str, size_t len);
 
+/* Mem payloads are allocated aligned and freed with their size, see
+   json_set_alloc_funcs_ex().  Blocks from jsonp_malloc_aligned() must be
+   freed with jsonp_free_sized(), never jsonp_free(). */
+void *jsonp_malloc_aligned(size_t size, size_t alignment);
+void jsonp_free_sized(void *ptr, size_t size);
+
 
 /* Windows compatibility */
 #if defined(_WIN32) || defined(WIN32)
@@ -0,0 +1,248 @@
+/*
+ * Large page allocator for big payloads.
+ *
+ * json_large_malloc() and json_large_free() have the signatures of the
+ * extended allocation hooks, so json_set_alloc_funcs_ex() can install them
+ * directly.  Requests that are freed with their size, which jansson marks by
+ * asking for an alignment, and that are at least the threshold in size are
+ * served from anonymous mappings.  The mappings are aligned to 2 MiB and
+ * advised for transparent huge pages where the system has them.  Freed
+ * mappings are kept in power of two size buckets and handed out again, so
+ * loading a fresh copy of a big buffer doesn't fault in new pages every
+ * time.  Everything else goes to the C library.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+/* C89 allows these to be macros */
+#undef malloc
+#undef free
+
+#define LARGE_PAGE_SIZE ((size_t)2 << 20)
+
+/* buckets hold mappings of LARGE_PAGE_SIZE << i bytes, bigger mappings are
+   never cached */
+#define LARGE_ALLOC_BUCKETS 11
+#define LARGE_ALLOC_BUCKET_DEPTH 4
+
+#ifndef _WIN32
+
+typedef struct {
+	void *maps[LARGE_ALLOC_BUCKET_DEPTH];
+	size_t count;
+} large_bucket_t;
+
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER;
+static large_bucket_t large_buckets[LARGE_ALLOC_BUCKETS];
+static size_t large_threshold = JSON_LARGE_ALLOC_DEFAULT_THRESHOLD;
+static json_large_alloc_stats_t large_stats;
+
+/* Returns the size of the mapping that holds size bytes, and its bucket or
+   LARGE_ALLOC_BUCKETS if it isn't cached */
+static size_t large_map_size(size_t size, size_t *bucket)
+{
+	size_t i, map_size = LARGE_PAGE_SIZE;
+
+	for (i = 0; i < LARGE_ALLOC_BUCKETS; i++, map_size <<= 1) {
+		if (size <= map_size) {
+			*bucket = i;
+			return map_size;
+		}
+	}
+
+	*bucket = LARGE_ALLOC_BUCKETS;
+	if (size > (size_t)-1 - LARGE_PAGE_SIZE)
+		return 0;
+	return (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+}
+
+/* Maps size bytes aligned to LARGE_PAGE_SIZE, which transparent huge pages
+   need, by over-mapping and trimming both ends */
+static void *large_map(size_t size)
+{
+	char *map, *aligned;
+	size_t head, tail;
+
+	if (size > (size_t)-1 - LARGE_PAGE_SIZE)
+		return NULL;
+
+	map = mmap(NULL, size + LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	aligned = (char *)(((size_t)map + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1));
+	head = aligned - map;
+	tail = LARGE_PAGE_SIZE - head;
+	if (head)
+		munmap(map, head);
+	if (tail)
+		munmap(aligned + size, tail);
+
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
+
+void *json_large_malloc(size_t size, size_t alignment)
+{
+	size_t map_size, bucket;
+	void *ptr = NULL;
+
+	if (!alignment)
+		return malloc(size);
+
+	if (size < large_threshold) {
+		if (alignment < sizeof(void *))
+			alignment = sizeof(void *);
+		if (posix_memalign(&ptr, alignment, size))
+			return NULL;
+		return ptr;
+	}
+
+	/* mappings are only aligned to the large page size */
+	if (alignment > LARGE_PAGE_SIZE)
+		return NULL;
+
+	map_size = large_map_size(size, &bucket);
+	if (!map_size)
+		return NULL;
+
+	pthread_mutex_lock(&large_lock);
+	if (bucket < LARGE_ALLOC_BUCKETS && large_buckets[bucket].count) {
+		ptr = large_buckets[bucket].maps[--large_buckets[bucket].count];
+		large_stats.hits++;
+		large_stats.bytes_cached -= map_size;
+	}
+	else
+		large_stats.misses++;
+	pthread_mutex_unlock(&large_lock);
+
+	if (ptr)
+		return ptr;
+
+	ptr = large_map(map_size);
+	if (!ptr)
+		return NULL;
+
+	pthread_mutex_lock(&large_lock);
+	large_stats.bytes_mapped += map_size;
+	pthread_mutex_unlock(&large_lock);
+	return ptr;
+}
+
+void json_large_free(void *ptr, size_t size)
+{
+	size_t map_size, bucket;
+
+	if (!ptr)
+		return;
+
+	/* blocks freed without their size, or below the threshold, came from
+	   the C library */
+	if (size < large_threshold) {
+		free(ptr);
+		return;
+	}
+
+	map_size = large_map_size(size, &bucket);
+
+	pthread_mutex_lock(&large_lock);
+	if (bucket < LARGE_ALLOC_BUCKETS && large_buckets[bucket].count < LARGE_ALLOC_BUCKET_DEPTH) {
+		large_buckets[bucket].maps[large_buckets[bucket].count++] = ptr;
+		large_stats.bytes_cached += map_size;
+		ptr = NULL;
+	}
+	else
+		large_stats.bytes_mapped -= map_size;
+	pthread_mutex_unlock(&large_lock);
+
+	if (ptr)
+		munmap(ptr, map_size);
+}
+
+void json_large_alloc_set_threshold(size_t threshold)
+{
+	large_threshold = threshold < LARGE_PAGE_SIZE ? LARGE_PAGE_SIZE : threshold;
+}
+
+void json_large_alloc_get_stats(json_large_alloc_stats_t *stats)
+{
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&large_lock);
+	*stats = large_stats;
+	pthread_mutex_unlock(&large_lock);
+}
+
+void json_large_alloc_trim(void)
+{
+	size_t i, map_size = LARGE_PAGE_SIZE;
+
+	pthread_mutex_lock(&large_lock);
+	for (i = 0; i < LARGE_ALLOC_BUCKETS; i++, map_size <<= 1) {
+		while (large_buckets[i].count) {
+			munmap(large_buckets[i].maps[--large_buckets[i].count], map_size);
+			large_stats.bytes_mapped -= map_size;
+			large_stats.bytes_cached -= map_size;
+		}
+	}
+	pthread_mutex_unlock(&large_lock);
+}
+
+#else /* _WIN32 */
+
+/* Large pages need a privilege most processes don't have on Windows, so
+   only the alignment is honored there */
+
+static json_large_alloc_stats_t large_stats;
+
+void *json_large_malloc(size_t size, size_t alignment)
+{
+	if (!alignment)
+		return malloc(size);
+	return _aligned_malloc(size, alignment);
+}
+
+void json_large_free(void *ptr, size_t size)
+{
+	if (size)
+		_aligned_free(ptr);
+	else
+		free(ptr);
+}
+
+void json_large_alloc_set_threshold(size_t threshold)
+{
+	(void)threshold;
+}
+
+void json_large_alloc_get_stats(json_large_alloc_stats_t *stats)
+{
+	if (stats)
+		*stats = large_stats;
+}
+
+void json_large_alloc_trim(void)
+{
+}
+
+#endif /* _WIN32 */
@@ -51,9 +51,19 @@
    behaviour of fgetc(). */
 typedef int(*get_func)(void *data);
 
+typedef struct
+{
+	const char *data;
+	size_t len;
+	size_t pos;
+} buffer_data_t;
+
+static int buffer_get(void *data);
+
 typedef struct {
 	get_func get;
 	void *data;
+	buffer_data_t *direct;  /* set when the input is in memory */
 	char buffer[5];
 	size_t buffer_pos;
 	int state;
@@ -67,6 +77,7 @@ typedef struct {
 	strbuffer_t saved_text;
 	size_t flags;
 	size_t depth;
+	int skip;
 	int token;
 	union {
 		struct {
@@ -84,7 +95,7 @@ typedef struct {
 /*** error reporting ***/
 
 static void error_set(json_error_t *error, const lex_t *lex,
-	const char *msg, ...)
+	enum json_error_code code, const char *msg, ...)
 {
 	va_list ap;
 	char msg_text[JSON_ERROR_TEXT_LENGTH];
@@ -94,8 +105,15 @@ static void error_set(json_error_t *error, const lex_t *lex,
 	size_t pos = 0;
 	const char *result = msg_text;
 
-	if (!error)
+	/* only the first error is kept, don't bother formatting the others */
+	if (!error || error->text[0] != '\0')
+		return;
+
+	if (lex && (lex->flags & JSON_NO_DIAGNOSTICS)) {
+		jsonp_error_set_text(error, lex->stream.line, lex->stream.column,
+			lex->stream.position, code, jsonp_error_code_text(code));
 		return;
+	}
 
 	va_start(ap, msg);
 	vsnprintf(msg_text, JSON_ERROR_TEXT_LENGTH, msg, ap);
@@ -134,7 +152,7 @@ static void error_set(json_error_t *error, const lex_t *lex,
 		}
 	}
 
-	jsonp_error_set(error, line, col, pos, "%s", result);
+	jsonp_error_set_text(error, line, col, pos, code, result);
 }
 
 
@@ -145,6 +163,7 @@ stream_init(stream_t *stream, get_func get, void *data)
 {
 	stream->get = get;
 	stream->data = data;
+	stream->direct = get == buffer_get ? (buffer_data_t *)data : NULL;
 	stream->buffer[0] = '\0';
 	stream->buffer_pos = 0;
 
@@ -213,7 +232,7 @@ static int stream_get(stream_t *stream, json_error_t *error)
 
 out:
 	stream->state = STREAM_STATE_ERROR;
-	error_set(error, stream_to_lex(stream), "unable to decode byte 0x%x", c);
+	error_set(error, stream_to_lex(stream), json_error_invalid_utf8, "unable to decode byte 0x%x", c);
 	return STREAM_STATE_ERROR;
 }
 
@@ -288,6 +307,39 @@ static void lex_save_cached(lex_t *lex)
 	}
 }
 
+/* Saves the run of plain string characters ahead in an in-memory input
+   with a single UTF-8 check, instead of decoding it a character at a time.
+   A run that doesn't validate is left for stream_get() to report. */
+static void lex_save_string_run(lex_t *lex)
+{
+	stream_t *stream = &lex->stream;
+	const char *start, *p, *end;
+	size_t columns = 0;
+
+	if (!stream->direct || stream->state != STREAM_STATE_OK ||
+		stream->buffer[stream->buffer_pos] != '\0')
+		return;
+
+	start = stream->direct->data + stream->direct->pos;
+	end = stream->direct->data + stream->direct->len;
+	for (p = start; p < end; p++) {
+		unsigned char u = (unsigned char)*p;
+		if (u < 0x20 || u == '"' || u == '\\')
+			break;
+		/* count characters, not continuation bytes */
+		if ((u & 0xC0) != 0x80)
+			columns++;
+	}
+
+	if (p == start || !utf8_check_string(start, p - start))
+		return;
+
+	strbuffer_append_bytes(&lex->saved_text, start, p - start);
+	stream->direct->pos += p - start;
+	stream->position += p - start;
+	stream->column += (int)columns;
+}
+
 static void lex_free_string(lex_t *lex)
 {
 	jsonp_free(lex->value.string.val);
@@ -324,11 +376,13 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 	int c;
 	const char *p;
 	char *t;
+	char scratch[4];
 	int i;
 
 	lex->value.string.val = NULL;
 	lex->token = TOKEN_INVALID;
 
+	lex_save_string_run(lex);
 	c = lex_get_save(lex, error);
 
 	while (c != '"') {
@@ -336,7 +390,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 			goto out;
 
 		else if (c == STREAM_STATE_EOF) {
-			error_set(error, lex, "premature end of input");
+			error_set(error, lex, json_error_premature_end_of_input, "premature end of input");
 			goto out;
 		}
 
@@ -344,9 +398,9 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 			/* control character */
 			lex_unget_unsave(lex, c);
 			if (c == '\n')
-				error_set(error, lex, "unexpected newline");
+				error_set(error, lex, json_error_invalid_syntax, "unexpected newline");
 			else
-				error_set(error, lex, "control character 0x%x", c);
+				error_set(error, lex, json_error_invalid_syntax, "control character 0x%x", c);
 			goto out;
 		}
 
@@ -356,7 +410,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 				c = lex_get_save(lex, error);
 				for (i = 0; i < 4; i++) {
 					if (!l_isxdigit(c)) {
-						error_set(error, lex, "invalid escape");
+						error_set(error, lex, json_error_invalid_syntax, "invalid escape");
 						goto out;
 					}
 					c = lex_get_save(lex, error);
@@ -366,12 +420,14 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 				c == 'f' || c == 'n' || c == 'r' || c == 't')
 				c = lex_get_save(lex, error);
 			else {
-				error_set(error, lex, "invalid escape");
+				error_set(error, lex, json_error_invalid_syntax, "invalid escape");
 				goto out;
 			}
 		}
-		else
+		else {
+			lex_save_string_run(lex);
 			c = lex_get_save(lex, error);
+		}
 	}
 
 	/* the actual value is at most of the same length as the source
@@ -381,17 +437,26 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 		 - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
 		   are converted to 4 bytes
 	*/
-	t = jsonp_malloc(lex->saved_text.length + 1);
-	if (!t) {
-		/* this is not very nice, since TOKEN_INVALID is returned */
-		goto out;
+	if (lex->skip) {
+		/* the string is only validated, each character is decoded into
+		   scratch and thrown away */
+		t = scratch;
+	}
+	else {
+		t = jsonp_malloc(lex->saved_text.length + 1);
+		if (!t) {
+			/* this is not very nice, since TOKEN_INVALID is returned */
+			goto out;
+		}
+		lex->value.string.val = t;
 	}
-	lex->value.string.val = t;
 
 	/* + 1 to skip the " */
 	p = strbuffer_value(&lex->saved_text) + 1;
 
 	while (*p != '"') {
+		if (lex->skip)
+			t = scratch;
 		if (*p == '\\') {
 			p++;
 			if (*p == 'u') {
@@ -400,7 +465,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 
 				value = decode_unicode_escape(p);
 				if (value < 0) {
-					error_set(error, lex, "invalid Unicode escape '%.6s'", p - 1);
+					error_set(error, lex, json_error_invalid_syntax, "invalid Unicode escape '%.6s'", p - 1);
 					goto out;
 				}
 				p += 5;
@@ -410,7 +475,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 					if (*p == '\\' && *(p + 1) == 'u') {
 						int32_t value2 = decode_unicode_escape(++p);
 						if (value2 < 0) {
-							error_set(error, lex, "invalid Unicode escape '%.6s'", p - 1);
+							error_set(error, lex, json_error_invalid_syntax, "invalid Unicode escape '%.6s'", p - 1);
 							goto out;
 						}
 						p += 5;
@@ -424,7 +489,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 						}
 						else {
 							/* invalid second surrogate */
-							error_set(error, lex,
+							error_set(error, lex, json_error_invalid_syntax,
 								"invalid Unicode '\\u%04X\\u%04X'",
 								value, value2);
 							goto out;
@@ -432,13 +497,13 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 					}
 					else {
 						/* no second surrogate */
-						error_set(error, lex, "invalid Unicode '\\u%04X'",
+						error_set(error, lex, json_error_invalid_syntax, "invalid Unicode '\\u%04X'",
 							value);
 						goto out;
 					}
 				}
 				else if (0xDC00 <= value && value <= 0xDFFF) {
-					error_set(error, lex, "invalid Unicode '\\u%04X'", value);
+					error_set(error, lex, json_error_invalid_syntax, "invalid Unicode '\\u%04X'", value);
 					goto out;
 				}
 
@@ -464,6 +529,10 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 		else
 			*(t++) = *(p++);
 	}
+	if (lex->skip) {
+		lex->token = TOKEN_STRING;
+		return;
+	}
 	*t = '\0';
 	lex->value.string.len = t - lex->value.string.val;
 	lex->token = TOKEN_STRING;
@@ -526,9 +595,9 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
 		intval = json_strtoint(saved_text, &end, 10);
 		if (errno == ERANGE) {
 			if (intval < 0)
-				error_set(error, lex, "too big negative integer");
+				error_set(error, lex, json_error_numeric_overflow, "too big negative integer");
 			else
-				error_set(error, lex, "too big integer");
+				error_set(error, lex, json_error_numeric_overflow, "too big integer");
 			goto out;
 		}
 
@@ -570,7 +639,7 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
 	lex_unget_unsave(lex, c);
 
 	if (jsonp_strtod(&lex->saved_text, &doubleval)) {
-		error_set(error, lex, "real number overflow");
+		error_set(error, lex, json_error_numeric_overflow, "real number overflow");
 		goto out;
 	}
 
@@ -669,6 +738,7 @@ static int lex_init(lex_t *lex, get_func get, size_t flags, void *data)
 		return -1;
 
 	lex->flags = flags;
+	lex->skip = 0;
 	lex->token = TOKEN_INVALID;
 	return 0;
 }
@@ -701,7 +771,7 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
 		json_t *value;
 
 		if (lex->token != TOKEN_STRING) {
-			error_set(error, lex, "string or '}' expected");
+			error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
 			goto error;
 		}
 
@@ -710,14 +780,14 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
 			return NULL;
 		if (memchr(key, '\0', len)) {
 			jsonp_free(key);
-			error_set(error, lex, "NUL byte in object key not supported");
+			error_set(error, lex, json_error_null_byte_in_key, "NUL byte in object key not supported");
 			goto error;
 		}
 
 		if (flags & JSON_REJECT_DUPLICATES) {
 			if (json_object_get(object, key)) {
 				jsonp_free(key);
-				error_set(error, lex, "duplicate object key");
+				error_set(error, lex, json_error_duplicate_key, "duplicate object key");
 				goto error;
 			}
 		}
@@ -725,7 +795,7 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
 		lex_scan(lex, error);
 		if (lex->token != ':') {
 			jsonp_free(key);
-			error_set(error, lex, "':' expected");
+			error_set(error, lex, json_error_invalid_syntax, "':' expected");
 			goto error;
 		}
 
@@ -753,7 +823,7 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
 	}
 
 	if (lex->token != '}') {
-		error_set(error, lex, "'}' expected");
+		error_set(error, lex, json_error_invalid_syntax, "'}' expected");
 		goto error;
 	}
 
@@ -793,7 +863,7 @@ static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error)
 	}
 
 	if (lex->token != ']') {
-		error_set(error, lex, "']' expected");
+		error_set(error, lex, json_error_invalid_syntax, "']' expected");
 		goto error;
 	}
 
@@ -810,7 +880,7 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
 
 	lex->depth++;
 	if (lex->depth > JSON_PARSER_MAX_DEPTH) {
-		error_set(error, lex, "maximum parsing depth reached");
+		error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
 		return NULL;
 	}
 
@@ -825,7 +895,7 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
 		{
 			len = len - MEM_TOKEN_LEN;
 			value = value + MEM_TOKEN_LEN;
-			mem = temp = malloc(len / 2);
+			mem = temp = jsonp_malloc_aligned(len / 2, JSON_MEM_ALIGNMENT);
 			if (!temp)
 				return NULL;
 
@@ -850,13 +920,15 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
 				}
 			}
 			json = json_mem_own(mem, len / 2);
+			if (!json)
+				jsonp_free_sized(mem, len / 2);
 		}
 		else
 		{
 
 			if (!(flags & JSON_ALLOW_NUL)) {
 				if (memchr(value, '\0', len)) {
-					error_set(error, lex, "\\u0000 is not allowed without JSON_ALLOW_NUL");
+					error_set(error, lex, json_error_null_character, "\\u0000 is not allowed without JSON_ALLOW_NUL");
 					return NULL;
 				}
 			}
@@ -901,11 +973,11 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
 		break;
 
 	case TOKEN_INVALID:
-		error_set(error, lex, "invalid token");
+		error_set(error, lex, json_error_invalid_syntax, "invalid token");
 		return NULL;
 
 	default:
-		error_set(error, lex, "unexpected token");
+		error_set(error, lex, json_error_invalid_syntax, "unexpected token");
 		return NULL;
 	}
 
@@ -925,7 +997,7 @@ static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error)
 	lex_scan(lex, error);
 	if (!(flags & JSON_DECODE_ANY)) {
 		if (lex->token != '[' && lex->token != '{') {
-			error_set(error, lex, "'[' or '{' expected");
+			error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
 			return NULL;
 		}
 	}
@@ -937,7 +1009,7 @@ static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error)
 	if (!(flags & JSON_DISABLE_EOF_CHECK)) {
 		lex_scan(lex, error);
 		if (lex->token != TOKEN_EOF) {
-			error_set(error, lex, "end of file expected");
+			error_set(error, lex, json_error_end_of_input_expected, "end of file expected");
 			json_decref(result);
 			return NULL;
 		}
@@ -951,43 +1023,438 @@ static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error)
 	return result;
 }
 
-typedef struct
+/*** skipping and partial parsing ***/
+
+static int skip_value_inner(lex_t *lex, json_error_t *error)
 {
-	const char *data;
-	size_t pos;
-} string_data_t;
+	int close;
+
+	lex->depth++;
+	if (lex->depth > JSON_PARSER_MAX_DEPTH) {
+		error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+		return -1;
+	}
+
+	switch (lex->token) {
+	case TOKEN_STRING:
+	case TOKEN_INTEGER:
+	case TOKEN_REAL:
+	case TOKEN_TRUE:
+	case TOKEN_FALSE:
+	case TOKEN_NULL:
+		lex->depth--;
+		return 0;
 
-static int string_get(void *data)
+	case '{':
+	case '[':
+		close = lex->token == '{' ? '}' : ']';
+		lex_scan(lex, error);
+		if (lex->token == close)
+			break;
+
+		while (1) {
+			if (close == '}') {
+				if (lex->token != TOKEN_STRING) {
+					error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+					return -1;
+				}
+				lex_scan(lex, error);
+				if (lex->token != ':') {
+					error_set(error, lex, json_error_invalid_syntax, "':' expected");
+					return -1;
+				}
+				lex_scan(lex, error);
+			}
+
+			if (skip_value_inner(lex, error))
+				return -1;
+
+			lex_scan(lex, error);
+			if (lex->token != ',')
+				break;
+			lex_scan(lex, error);
+		}
+
+		if (lex->token != close) {
+			error_set(error, lex, json_error_invalid_syntax, close == '}' ? "'}' expected" : "']' expected");
+			return -1;
+		}
+		break;
+
+	case TOKEN_INVALID:
+		error_set(error, lex, json_error_invalid_syntax, "invalid token");
+		return -1;
+
+	default:
+		error_set(error, lex, json_error_invalid_syntax, "unexpected token");
+		return -1;
+	}
+
+	lex->depth--;
+	return 0;
+}
+
+/* Scans the next value and checks that it is valid without building it.
+   Strings are validated but not decoded, so nothing is allocated. */
+static int skip_value(lex_t *lex, json_error_t *error)
 {
-	char c;
-	string_data_t *stream = (string_data_t *)data;
-	c = stream->data[stream->pos];
-	if (c == '\0')
-		return EOF;
-	else
-	{
-		stream->pos++;
-		return (unsigned char)c;
+	int ret;
+
+	lex->skip = 1;
+	lex_scan(lex, error);
+	ret = skip_value_inner(lex, error);
+	lex->skip = 0;
+	return ret;
+}
+
+/* Parses the value path refers to, starting at the token in lex, and skips and
+   validates the rest of the value.  Like json_object_get() on the result of
+   json_loads(), the last of several equal keys wins.  *out is set to NULL if
+   the path isn't there. */
+static int parse_path(lex_t *lex, const json_path_t *path, size_t level, size_t flags, json_t **out, json_error_t *error)
+{
+	const json_path_token_t *token;
+	json_t *found = NULL, *value;
+	size_t index;
+	int close, matched = 0, ret;
+
+	*out = NULL;
+
+	if (level == path->count) {
+		*out = parse_value(lex, flags, error);
+		return *out ? 0 : -1;
+	}
+
+	token = &path->tokens[level];
+	if (lex->token != '{' && (lex->token != '[' || !token->is_index)) {
+		lex->skip = 1;
+		ret = skip_value_inner(lex, error);
+		lex->skip = 0;
+		return ret;
+	}
+	close = lex->token == '{' ? '}' : ']';
+
+	lex->depth++;
+	if (lex->depth > JSON_PARSER_MAX_DEPTH) {
+		error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+		return -1;
+	}
+
+	for (index = 0; ; index++) {
+		if (close == '}') {
+			lex_scan(lex, error);
+			if (index == 0 && lex->token == '}')
+				break;
+			if (lex->token != TOKEN_STRING) {
+				error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+				goto error;
+			}
+
+			if (lex->value.string.len == token->length &&
+				memcmp(lex->value.string.val, token->key, token->length) == 0) {
+				if (matched && (flags & JSON_REJECT_DUPLICATES)) {
+					error_set(error, lex, json_error_duplicate_key, "duplicate object key");
+					goto error;
+				}
+				lex_scan(lex, error);
+				if (lex->token != ':') {
+					error_set(error, lex, json_error_invalid_syntax, "':' expected");
+					goto error;
+				}
+				lex_scan(lex, error);
+				if (parse_path(lex, path, level + 1, flags, &value, error))
+					goto error;
+				json_decref(found);
+				found = value;
+				matched = 1;
+			}
+			else {
+				lex_scan(lex, error);
+				if (lex->token != ':') {
+					error_set(error, lex, json_error_invalid_syntax, "':' expected");
+					goto error;
+				}
+				if (skip_value(lex, error))
+					goto error;
+			}
+		}
+		else {
+			lex->skip = index != token->index;
+			lex_scan(lex, error);
+			if (index == 0 && lex->token == ']') {
+				lex->skip = 0;
+				break;
+			}
+
+			if (index == token->index) {
+				if (parse_path(lex, path, level + 1, flags, &found, error))
+					goto error;
+			}
+			else {
+				ret = skip_value_inner(lex, error);
+				lex->skip = 0;
+				if (ret)
+					goto error;
+			}
+		}
+
+		lex_scan(lex, error);
+		if (lex->token != ',')
+			break;
+	}
+
+	if (lex->token != close) {
+		error_set(error, lex, json_error_invalid_syntax, close == '}' ? "'}' expected" : "']' expected");
+		goto error;
+	}
+
+	lex->depth--;
+	*out = found;
+	return 0;
+
+error:
+	json_decref(found);
+	return -1;
+}
+
+static json_t *parse_json_path(lex_t *lex, const json_path_t *path, size_t flags, json_error_t *error)
+{
+	json_t *result;
+
+	lex->depth = 0;
+
+	lex_scan(lex, error);
+	if (!(flags & JSON_DECODE_ANY)) {
+		if (lex->token != '[' && lex->token != '{') {
+			error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+			return NULL;
+		}
+	}
+
+	if (parse_path(lex, path, 0, flags, &result, error))
+		return NULL;
+
+	if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+		lex_scan(lex, error);
+		if (lex->token != TOKEN_EOF) {
+			error_set(error, lex, json_error_end_of_input_expected, "end of file expected");
+			json_decref(result);
+			return NULL;
+		}
+	}
+
+	if (!result) {
+		error_set(error, lex, json_error_item_not_found, "path not found");
+		return NULL;
+	}
+
+	if (error) {
+		/* Save the position even though there was no error */
+		error->position = (int)lex->stream.position;
+	}
+
+	return result;
+}
+
+/* Parses the value at the token in lex, keeping only the parts the filter
+   node wants.  Array elements keep their indices, with null in place of the
+   skipped ones before the last kept element.  *out is set to NULL if none of
+   it is wanted. */
+static int parse_filtered(lex_t *lex, const json_filter_node_t *node, size_t flags, json_t **out, json_error_t *error)
+{
+	json_t *result;
+	size_t index;
+	int close, ret;
+
+	*out = NULL;
+
+	if (node->keep) {
+		*out = parse_value(lex, flags, error);
+		return *out ? 0 : -1;
+	}
+
+	if (lex->token != '{' && lex->token != '[') {
+		lex->skip = 1;
+		ret = skip_value_inner(lex, error);
+		lex->skip = 0;
+		return ret;
+	}
+
+	close = lex->token == '{' ? '}' : ']';
+	result = close == '}' ? json_object() : json_array();
+	if (!result)
+		return -1;
+
+	lex->depth++;
+	if (lex->depth > JSON_PARSER_MAX_DEPTH) {
+		error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+		goto error;
+	}
+
+	for (index = 0; ; index++) {
+		const json_filter_node_t *child;
+		json_t *value;
+
+		if (close == '}') {
+			char *key;
+			size_t len;
+
+			lex_scan(lex, error);
+			if (index == 0 && lex->token == '}')
+				break;
+			if (lex->token != TOKEN_STRING) {
+				error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+				goto error;
+			}
+
+			child = jsonp_filter_child(node, lex->value.string.val, lex->value.string.len);
+			if (!child) {
+				lex_scan(lex, error);
+				if (lex->token != ':') {
+					error_set(error, lex, json_error_invalid_syntax, "':' expected");
+					goto error;
+				}
+				if (skip_value(lex, error))
+					goto error;
+			}
+			else {
+				key = lex_steal_string(lex, &len);
+				if (!key)
+					goto error;
+
+				if ((flags & JSON_REJECT_DUPLICATES) && json_object_get(result, key)) {
+					jsonp_free(key);
+					error_set(error, lex, json_error_duplicate_key, "duplicate object key");
+					goto error;
+				}
+
+				lex_scan(lex, error);
+				if (lex->token != ':') {
+					jsonp_free(key);
+					error_set(error, lex, json_error_invalid_syntax, "':' expected");
+					goto error;
+				}
+
+				lex_scan(lex, error);
+				if (parse_filtered(lex, child, flags, &value, error)) {
+					jsonp_free(key);
+					goto error;
+				}
+				if (value && json_object_set_new_nocheck(result, key, value)) {
+					jsonp_free(key);
+					goto error;
+				}
+				jsonp_free(key);
+			}
+		}
+		else {
+			child = jsonp_filter_index(node, index);
+
+			lex->skip = !child;
+			lex_scan(lex, error);
+			if (index == 0 && lex->token == ']') {
+				lex->skip = 0;
+				break;
+			}
+
+			if (!child) {
+				ret = skip_value_inner(lex, error);
+				lex->skip = 0;
+				if (ret)
+					goto error;
+			}
+			else {
+				if (parse_filtered(lex, child, flags, &value, error))
+					goto error;
+				if (value) {
+					/* kept elements stay at their index, the skipped ones
+					   before them become null */
+					while (json_array_size(result) < index) {
+						if (json_array_append_new(result, json_null())) {
+							json_decref(value);
+							goto error;
+						}
+					}
+					if (json_array_append_new(result, value))
+						goto error;
+				}
+			}
+		}
+
+		lex_scan(lex, error);
+		if (lex->token != ',')
+			break;
+	}
+
+	if (lex->token != close) {
+		error_set(error, lex, json_error_invalid_syntax, close == '}' ? "'}' expected" : "']' expected");
+		goto error;
+	}
+
+	lex->depth--;
+	*out = result;
+	return 0;
+
+error:
+	json_decref(result);
+	return -1;
+}
+
+static json_t *parse_json_filtered(lex_t *lex, const json_filter_t *filter, size_t flags, json_error_t *error)
+{
+	json_t *result;
+
+	lex->depth = 0;
+
+	lex_scan(lex, error);
+	if (!(flags & JSON_DECODE_ANY)) {
+		if (lex->token != '[' && lex->token != '{') {
+			error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+			return NULL;
+		}
+	}
+
+	if (parse_filtered(lex, &filter->root, flags, &result, error))
+		return NULL;
+	if (!result)
+		result = json_null();
+
+	if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+		lex_scan(lex, error);
+		if (lex->token != TOKEN_EOF) {
+			error_set(error, lex, json_error_end_of_input_expected, "end of file expected");
+			json_decref(result);
+			return NULL;
+		}
 	}
+
+	if (error) {
+		/* Save the position even though there was no error */
+		error->position = (int)lex->stream.position;
+	}
+
+	return result;
 }
 
 json_t *json_loads(const char *string, size_t flags, json_error_t *error)
 {
 	lex_t lex;
 	json_t *result;
-	string_data_t stream_data;
+	buffer_data_t stream_data;
 
 	jsonp_error_init(error, "<string>");
 
 	if (string == NULL) {
-		error_set(error, NULL, "wrong arguments");
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
 		return NULL;
 	}
 
+	/* read strings as buffers, which lets the lexer scan them in place */
 	stream_data.data = string;
 	stream_data.pos = 0;
+	stream_data.len = strlen(string);
 
-	if (lex_init(&lex, string_get, flags, (void *)&stream_data))
+	if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
 		return NULL;
 
 	result = parse_json(&lex, flags, error);
@@ -996,13 +1463,6 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error)
 	return result;
 }
 
-typedef struct
-{
-	const char *data;
-	size_t len;
-	size_t pos;
-} buffer_data_t;
-
 static int buffer_get(void *data)
 {
 	char c;
@@ -1024,7 +1484,7 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
 	jsonp_error_init(error, "<buffer>");
 
 	if (buffer == NULL) {
-		error_set(error, NULL, "wrong arguments");
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
 		return NULL;
 	}
 
@@ -1041,6 +1501,152 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
 	return result;
 }
 
+json_t *json_loads_path(const char *string, const json_path_t *path, size_t flags, json_error_t *error)
+{
+	lex_t lex;
+	json_t *result;
+	buffer_data_t stream_data;
+
+	jsonp_error_init(error, "<string>");
+
+	if (string == NULL || path == NULL) {
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+		return NULL;
+	}
+
+	stream_data.data = string;
+	stream_data.pos = 0;
+	stream_data.len = strlen(string);
+
+	if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+		return NULL;
+
+	result = parse_json_path(&lex, path, flags, error);
+
+	lex_close(&lex);
+	return result;
+}
+
+json_t *json_loadb_path(const char *buffer, size_t buflen, const json_path_t *path, size_t flags, json_error_t *error)
+{
+	lex_t lex;
+	json_t *result;
+	buffer_data_t stream_data;
+
+	jsonp_error_init(error, "<buffer>");
+
+	if (buffer == NULL || path == NULL) {
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+		return NULL;
+	}
+
+	stream_data.data = buffer;
+	stream_data.pos = 0;
+	stream_data.len = buflen;
+
+	if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+		return NULL;
+
+	result = parse_json_path(&lex, path, flags, error);
+
+	lex_close(&lex);
+	return result;
+}
+
+json_t *json_loads_filtered(const char *string, const json_filter_t *filter, size_t flags, json_error_t *error)
+{
+	lex_t lex;
+	json_t *result;
+	buffer_data_t stream_data;
+
+	jsonp_error_init(error, "<string>");
+
+	if (string == NULL || filter == NULL) {
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+		return NULL;
+	}
+
+	stream_data.data = string;
+	stream_data.pos = 0;
+	stream_data.len = strlen(string);
+
+	if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+		return NULL;
+
+	result = parse_json_filtered(&lex, filter, flags, error);
+
+	lex_close(&lex);
+	return result;
+}
+
+json_t *json_loadb_filtered(const char *buffer, size_t buflen, const json_filter_t *filter, size_t flags, json_error_t *error)
+{
+	lex_t lex;
+	json_t *result;
+	buffer_data_t stream_data;
+
+	jsonp_error_init(error, "<buffer>");
+
+	if (buffer == NULL || filter == NULL) {
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+		return NULL;
+	}
+
+	stream_data.data = buffer;
+	stream_data.pos = 0;
+	stream_data.len = buflen;
+
+	if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+		return NULL;
+
+	result = parse_json_filtered(&lex, filter, flags, error);
+
+	lex_close(&lex);
+	return result;
+}
+
+/* Parses a comma separated run of array elements, the inside of an array
+   without its brackets, and appends them to array */
+int jsonp_loadb_elements(const char *buffer, size_t buflen, size_t flags, json_t *array, json_error_t *error)
+{
+	lex_t lex;
+	buffer_data_t stream_data;
+	int ret = -1;
+
+	jsonp_error_init(error, "<buffer>");
+
+	stream_data.data = buffer;
+	stream_data.pos = 0;
+	stream_data.len = buflen;
+
+	if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+		return -1;
+
+	/* the elements are inside the top level array */
+	lex.depth = 1;
+
+	lex_scan(&lex, error);
+	while (1) {
+		json_t *elem = parse_value(&lex, flags, error);
+		if (!elem || json_array_append_new(array, elem))
+			goto out;
+
+		lex_scan(&lex, error);
+		if (lex.token == TOKEN_EOF)
+			break;
+		if (lex.token != ',') {
+			error_set(error, &lex, json_error_invalid_syntax, "',' expected");
+			goto out;
+		}
+		lex_scan(&lex, error);
+	}
+	ret = 0;
+
+out:
+	lex_close(&lex);
+	return ret;
+}
+
 json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
 {
 	lex_t lex;
@@ -1055,7 +1661,7 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
 	jsonp_error_init(error, source);
 
 	if (input == NULL) {
-		error_set(error, NULL, "wrong arguments");
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
 		return NULL;
 	}
 
@@ -1094,7 +1700,7 @@ json_t *json_loadfd(int input, size_t flags, json_error_t *error)
 	jsonp_error_init(error, source);
 
 	if (input < 0) {
-		error_set(error, NULL, "wrong arguments");
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
 		return NULL;
 	}
 
@@ -1115,14 +1721,14 @@ json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
 	jsonp_error_init(error, path);
 
 	if (path == NULL) {
-		error_set(error, NULL, "wrong arguments");
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
 		return NULL;
 	}
 
 	fp = fopen(path, "rb");
 	if (!fp)
 	{
-		error_set(error, NULL, "unable to open %s: %s",
+		error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s",
 			path, strerror(errno));
 		return NULL;
 	}
@@ -1175,7 +1781,7 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
 	jsonp_error_init(error, "<callback>");
 
 	if (callback == NULL) {
-		error_set(error, NULL, "wrong arguments");
+		error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
 		return NULL;
 	}
 
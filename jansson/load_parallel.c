@@ -0,0 +1,242 @@
+/*
+ * Parallel loading of large top level arrays.
+ *
+ * A quick structural scan finds the commas between top level elements,
+ * tracking only nesting and string boundaries, and splits the elements into
+ * one run of roughly equal size per thread.  Each thread parses its run into
+ * its own array with the normal parser, and the runs are then joined in
+ * order.  Anything the scan doesn't like, and any parse error, falls back to
+ * json_loadb() so that results and error messages always match a serial
+ * parse.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+/* Inputs smaller than this aren't worth starting threads for */
+#define PARALLEL_MIN_CHUNK_SIZE (64 * 1024)
+
+#define is_space(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+typedef struct {
+	const char *buffer;
+	size_t length;
+	size_t flags;
+	json_t *array;
+	int failed;
+} parse_chunk_t;
+
+static size_t online_cpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (size_t)count : 1;
+#else
+	return 1;
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI parse_chunk(LPVOID data)
+#else
+static void *parse_chunk(void *data)
+#endif
+{
+	parse_chunk_t *chunk = (parse_chunk_t *)data;
+
+	chunk->array = json_array();
+	chunk->failed = !chunk->array ||
+		jsonp_loadb_elements(chunk->buffer, chunk->length, chunk->flags, chunk->array, NULL);
+	return 0;
+}
+
+/* Splits the inside of the top level array into at most nchunks runs of
+   elements, cutting at the first top level comma after each target offset.
+   Returns the number of runs, 0 for an empty array, or -1 if the input isn't
+   a well formed top level array as far as the scan can tell.  end is set to
+   the offset just past the closing bracket. */
+static int split_elements(const char *buffer, size_t buflen, size_t flags,
+	parse_chunk_t *chunks, size_t nchunks, size_t *end)
+{
+	size_t i, start, target, count = 0, depth = 1;
+	int content = 0;
+
+	for (i = 0; i < buflen && is_space(buffer[i]); i++)
+		;
+	if (i == buflen || buffer[i] != '[')
+		return -1;
+
+	start = ++i;
+	target = start + (buflen - start) / nchunks;
+
+	for (; i < buflen; i++) {
+		char c = buffer[i];
+
+		if (c == '"') {
+			for (i++; i < buflen && buffer[i] != '"'; i++) {
+				if (buffer[i] == '\\')
+					i++;
+			}
+			if (i >= buflen)
+				return -1;
+			content = 1;
+		}
+		else if (c == '[' || c == '{') {
+			depth++;
+			content = 1;
+		}
+		else if (c == ']' || c == '}') {
+			if (--depth == 0)
+				break;
+		}
+		else if (c == ',' && depth == 1) {
+			if (!content)
+				return -1;
+			if (i >= target && count + 1 < nchunks) {
+				chunks[count].buffer = buffer + start;
+				chunks[count].length = i - start;
+				count++;
+				start = i + 1;
+				target = start + (buflen - start) / (nchunks - count);
+			}
+			content = 0;
+		}
+		else if (!is_space(c))
+			content = 1;
+	}
+
+	if (i >= buflen || buffer[i] != ']')
+		return -1;
+	*end = i + 1;
+
+	/* trailing garbage is left for the serial parser to report */
+	if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+		size_t j;
+		for (j = i + 1; j < buflen; j++) {
+			if (!is_space(buffer[j]))
+				return -1;
+		}
+	}
+
+	if (!content)
+		return count == 0 ? 0 : -1;
+
+	chunks[count].buffer = buffer + start;
+	chunks[count].length = i - start;
+	return (int)count + 1;
+}
+
+json_t *json_loadb_parallel(const char *buffer, size_t buflen, size_t nthreads, size_t flags, json_error_t *error)
+{
+	parse_chunk_t *chunks;
+	json_t *result = NULL;
+	size_t end = buflen;
+	int count, i, started = 0, failed = 0;
+#ifdef _WIN32
+	HANDLE *threads;
+#else
+	pthread_t *threads;
+#endif
+
+	/* more threads than processors only adds overhead */
+	if (nthreads == 0 || nthreads > online_cpus())
+		nthreads = online_cpus();
+	if (!buffer || nthreads > buflen / PARALLEL_MIN_CHUNK_SIZE)
+		nthreads = buflen / PARALLEL_MIN_CHUNK_SIZE;
+	if (nthreads <= 1)
+		return json_loadb(buffer, buflen, flags, error);
+
+	chunks = jsonp_malloc(nthreads * sizeof(parse_chunk_t));
+	threads = jsonp_malloc(nthreads * sizeof(*threads));
+	if (!chunks || !threads)
+		goto serial;
+	memset(chunks, 0, nthreads * sizeof(parse_chunk_t));
+
+	count = split_elements(buffer, buflen, flags, chunks, nthreads, &end);
+	if (count <= 1)
+		goto serial;
+
+	/* seeding isn't thread safe on every platform, so make sure it's done
+	   before any thread creates an object */
+	json_object_seed(0);
+
+	for (i = 0; i < count; i++) {
+		chunks[i].flags = flags;
+		if (i == 0)
+			continue;
+#ifdef _WIN32
+		threads[i] = CreateThread(NULL, 0, parse_chunk, &chunks[i], 0, NULL);
+		if (!threads[i])
+			break;
+#else
+		if (pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]))
+			break;
+#endif
+		started = i;
+	}
+
+	/* the calling thread takes the first run, and any the threads couldn't */
+	parse_chunk(&chunks[0]);
+	for (i = started + 1; i < count; i++)
+		parse_chunk(&chunks[i]);
+
+	for (i = 1; i <= started; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+
+	for (i = 0; i < count; i++)
+		failed |= chunks[i].failed;
+
+	if (!failed) {
+		result = chunks[0].array;
+		chunks[0].array = NULL;
+		for (i = 1; result && i < count; i++) {
+			if (json_array_extend(result, chunks[i].array)) {
+				json_decref(result);
+				result = NULL;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		json_decref(chunks[i].array);
+
+	if (!result)
+		goto serial;
+
+	jsonp_error_init(error, "<buffer>");
+	if (error)
+		error->position = (int)(flags & JSON_DISABLE_EOF_CHECK ? end : buflen);
+	jsonp_free(chunks);
+	jsonp_free(threads);
+	return result;
+
+serial:
+	/* the serial parser gives the same errors a serial parse would */
+	jsonp_free(chunks);
+	jsonp_free(threads);
+	return json_loadb(buffer, buflen, flags, error);
+}
@@ -20,11 +20,18 @@
 static json_malloc_t do_malloc = malloc;
 static json_free_t do_free = free;
 
+/* extended memory function pointers, used instead of the above when set */
+static json_malloc_ex_t do_malloc_ex = NULL;
+static json_free_ex_t do_free_ex = NULL;
+
 void *jsonp_malloc(size_t size)
 {
     if(!size)
         return NULL;
 
+    if(do_malloc_ex)
+        return (*do_malloc_ex)(size, 0);
+
     return (*do_malloc)(size);
 }
 
@@ -33,7 +40,52 @@ void jsonp_free(void *ptr)
     if(!ptr)
         return;
 
-    (*do_free)(ptr);
+    if(do_free_ex)
+        (*do_free_ex)(ptr, 0);
+    else
+        (*do_free)(ptr);
+}
+
+void *jsonp_malloc_aligned(size_t size, size_t alignment)
+{
+    char *ptr, *aligned;
+
+    /* zero length payloads are valid, and need a unique pointer too */
+    if(!size)
+        size = 1;
+
+    if(do_malloc_ex)
+        return (*do_malloc_ex)(size, alignment);
+
+    /* plain hooks know nothing about alignment, so over-allocate and keep
+       the original pointer just below the aligned block */
+    if(size > (size_t)-1 - alignment - sizeof(void *))
+        return NULL;
+
+    ptr = (*do_malloc)(size + alignment + sizeof(void *));
+    if(!ptr)
+        return NULL;
+
+    aligned = ptr + sizeof(void *);
+    aligned += (alignment - (size_t)aligned % alignment) % alignment;
+    memcpy(aligned - sizeof(void *), &ptr, sizeof(void *));
+    return aligned;
+}
+
+void jsonp_free_sized(void *ptr, size_t size)
+{
+    void *original;
+
+    if(!ptr)
+        return;
+
+    if(do_free_ex) {
+        (*do_free_ex)(ptr, size ? size : 1);
+        return;
+    }
+
+    memcpy(&original, (char *)ptr - sizeof(void *), sizeof(void *));
+    (*do_free)(original);
 }
 
 char *jsonp_strdup(const char *str)
@@ -58,6 +110,27 @@ void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn)
 {
     do_malloc = malloc_fn;
     do_free = free_fn;
+    do_malloc_ex = NULL;
+    do_free_ex = NULL;
+}
+
+void json_set_alloc_funcs_ex(json_malloc_ex_t malloc_fn, json_free_ex_t free_fn)
+{
+    if(!malloc_fn || !free_fn) {
+        json_set_alloc_funcs(malloc, free);
+        return;
+    }
+
+    do_malloc_ex = malloc_fn;
+    do_free_ex = free_fn;
+}
+
+void json_get_alloc_funcs_ex(json_malloc_ex_t *malloc_fn, json_free_ex_t *free_fn)
+{
+    if (malloc_fn)
+        *malloc_fn = do_malloc_ex;
+    if (free_fn)
+        *free_fn = do_free_ex;
 }
 
 void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn)
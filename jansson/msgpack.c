@@ -0,0 +1,691 @@
+/*
+ * MessagePack encoding and decoding of json_t values.
+ *
+ * This is a compact binary alternative to the JSON text format for values
+ * that are only ever read back by us, such as mutator state.  Every JSON type
+ * maps onto its MessagePack counterpart, and JSON_MEM values are stored as
+ * native bin objects rather than hex strings.  Reals are always written as
+ * float64 so that they round trip exactly.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "strbuffer.h"
+#include "utf.h"
+
+#if JSON_INTEGER_IS_LONG_LONG
+#define MSGPACK_INTEGER_MAX LLONG_MAX
+#else
+#define MSGPACK_INTEGER_MAX LONG_MAX
+#endif
+
+/* Keys up to this length are decoded without a heap allocation */
+#define MSGPACK_KEY_BUFFER_SIZE 64
+
+/*** encoding ***/
+
+static int dump_to_strbuffer(const char *buffer, size_t size, void *data)
+{
+	return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
+}
+
+struct buffer {
+	const size_t size;
+	size_t used;
+	char *data;
+};
+
+static int dump_to_buffer(const char *buffer, size_t size, void *data)
+{
+	struct buffer *buf = (struct buffer *)data;
+
+	if (buf->used + size <= buf->size)
+		memcpy(&buf->data[buf->used], buffer, size);
+
+	buf->used += size;
+	return 0;
+}
+
+static int msgpack_dump_header(unsigned char type, uint64_t value, int width,
+	json_dump_callback_t dump, void *data)
+{
+	unsigned char header[9];
+	int i;
+
+	header[0] = type;
+	for (i = width; i > 0; i--) {
+		header[i] = (unsigned char)(value & 0xff);
+		value >>= 8;
+	}
+	return dump((const char *)header, width + 1, data);
+}
+
+/* Writes the type byte for a str, bin, array or map of the given length,
+   using the fixed size form when there is one */
+static int msgpack_dump_length(unsigned char fix, size_t fix_max, const unsigned char *types,
+	size_t length, json_dump_callback_t dump, void *data)
+{
+	if (fix && length <= fix_max)
+		return msgpack_dump_header((unsigned char)(fix | length), 0, 0, dump, data);
+	if (types[0] && length <= 0xff)
+		return msgpack_dump_header(types[0], length, 1, dump, data);
+	if (length <= 0xffff)
+		return msgpack_dump_header(types[1], length, 2, dump, data);
+	if ((uint64_t)length <= 0xffffffffULL)
+		return msgpack_dump_header(types[2], length, 4, dump, data);
+	return -1;
+}
+
+static const unsigned char str_types[] = { 0xd9, 0xda, 0xdb };
+static const unsigned char bin_types[] = { 0xc4, 0xc5, 0xc6 };
+static const unsigned char array_types[] = { 0, 0xdc, 0xdd };
+static const unsigned char map_types[] = { 0, 0xde, 0xdf };
+
+static int msgpack_dump_string(const char *str, size_t length, json_dump_callback_t dump, void *data)
+{
+	if (msgpack_dump_length(0xa0, 31, str_types, length, dump, data))
+		return -1;
+	return length ? dump(str, length, data) : 0;
+}
+
+static int msgpack_dump_integer(json_int_t value, json_dump_callback_t dump, void *data)
+{
+	if (value >= 0) {
+		if (value <= 0x7f)
+			return msgpack_dump_header((unsigned char)value, 0, 0, dump, data);
+		if (value <= 0xff)
+			return msgpack_dump_header(0xcc, value, 1, dump, data);
+		if (value <= 0xffff)
+			return msgpack_dump_header(0xcd, value, 2, dump, data);
+		if (value <= 0xffffffffLL)
+			return msgpack_dump_header(0xce, value, 4, dump, data);
+		return msgpack_dump_header(0xcf, value, 8, dump, data);
+	}
+
+	if (value >= -32)
+		return msgpack_dump_header((unsigned char)(value & 0xff), 0, 0, dump, data);
+	if (value >= -0x80)
+		return msgpack_dump_header(0xd0, (uint64_t)value & 0xff, 1, dump, data);
+	if (value >= -0x8000)
+		return msgpack_dump_header(0xd1, (uint64_t)value & 0xffff, 2, dump, data);
+	if (value >= -0x80000000LL)
+		return msgpack_dump_header(0xd2, (uint64_t)value & 0xffffffffULL, 4, dump, data);
+	return msgpack_dump_header(0xd3, (uint64_t)value, 8, dump, data);
+}
+
+static int compare_keys(const void *key1, const void *key2)
+{
+	return strcmp(*(const char **)key1, *(const char **)key2);
+}
+
+static int msgpack_dump(const json_t *json, size_t flags, json_dump_callback_t dump, void *data)
+{
+	switch (json_typeof(json)) {
+	case JSON_NULL:
+		return msgpack_dump_header(0xc0, 0, 0, dump, data);
+
+	case JSON_FALSE:
+		return msgpack_dump_header(0xc2, 0, 0, dump, data);
+
+	case JSON_TRUE:
+		return msgpack_dump_header(0xc3, 0, 0, dump, data);
+
+	case JSON_INTEGER:
+		return msgpack_dump_integer(json_integer_value(json), dump, data);
+
+	case JSON_REAL:
+	{
+		double value = json_real_value(json);
+		uint64_t bits;
+
+		memcpy(&bits, &value, sizeof(bits));
+		return msgpack_dump_header(0xcb, bits, 8, dump, data);
+	}
+
+	case JSON_STRING:
+		return msgpack_dump_string(json_string_value(json), json_string_length(json), dump, data);
+
+	case JSON_MEM:
+	{
+		size_t length = json_mem_length(json);
+
+		if (msgpack_dump_length(0, 0, bin_types, length, dump, data))
+			return -1;
+		return length ? dump(json_mem_value(json), length, data) : 0;
+	}
+
+	case JSON_ARRAY:
+	{
+		json_array_t *array;
+		size_t i, n;
+
+		/* detect circular references */
+		array = json_to_array(json);
+		if (array->visited)
+			return -1;
+		array->visited = 1;
+
+		n = json_array_size(json);
+		if (msgpack_dump_length(0x90, 15, array_types, n, dump, data))
+			goto array_error;
+
+		for (i = 0; i < n; i++) {
+			if (msgpack_dump(json_array_get(json, i), flags, dump, data))
+				goto array_error;
+		}
+
+		array->visited = 0;
+		return 0;
+
+	array_error:
+		array->visited = 0;
+		return -1;
+	}
+
+	case JSON_OBJECT:
+	{
+		json_object_t *object;
+		const char **keys = NULL;
+		void *iter;
+		size_t i, n;
+
+		/* detect circular references */
+		object = json_to_object(json);
+		if (object->visited)
+			return -1;
+		object->visited = 1;
+
+		n = json_object_size(json);
+		if (msgpack_dump_length(0x80, 15, map_types, n, dump, data))
+			goto object_error;
+
+		iter = json_object_iter((json_t *)json);
+		if (flags & JSON_SORT_KEYS) {
+			keys = jsonp_malloc(n * sizeof(const char *));
+			if (n && !keys)
+				goto object_error;
+
+			for (i = 0; iter; i++) {
+				keys[i] = json_object_iter_key(iter);
+				iter = json_object_iter_next((json_t *)json, iter);
+			}
+			if (n)
+				qsort(keys, n, sizeof(const char *), compare_keys);
+
+			for (i = 0; i < n; i++) {
+				if (msgpack_dump_string(keys[i], strlen(keys[i]), dump, data) ||
+					msgpack_dump(json_object_get(json, keys[i]), flags, dump, data))
+					goto object_error;
+			}
+			jsonp_free(keys);
+			keys = NULL;
+		}
+		else {
+			while (iter) {
+				const char *key = json_object_iter_key(iter);
+
+				if (msgpack_dump_string(key, strlen(key), dump, data) ||
+					msgpack_dump(json_object_iter_value(iter), flags, dump, data))
+					goto object_error;
+				iter = json_object_iter_next((json_t *)json, iter);
+			}
+		}
+
+		object->visited = 0;
+		return 0;
+
+	object_error:
+		jsonp_free(keys);
+		object->visited = 0;
+		return -1;
+	}
+
+	default:
+		/* not reached */
+		return -1;
+	}
+}
+
+int json_msgpack_dump_callback(const json_t *json, json_dump_callback_t callback, void *data, size_t flags)
+{
+	if (!json)
+		return -1;
+
+	if (!(flags & JSON_ENCODE_ANY)) {
+		if (!json_is_array(json) && !json_is_object(json))
+			return -1;
+	}
+
+	return msgpack_dump(json, flags, callback, data);
+}
+
+char *json_msgpack_dumps(const json_t *json, size_t flags, size_t *size)
+{
+	strbuffer_t strbuff;
+	char *result;
+
+	if (strbuffer_init(&strbuff))
+		return NULL;
+
+	if (json_msgpack_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags)) {
+		strbuffer_close(&strbuff);
+		return NULL;
+	}
+
+	if (size)
+		*size = strbuff.length;
+	result = strbuffer_steal_value(&strbuff);
+	return result;
+}
+
+size_t json_msgpack_dumpb(const json_t *json, char *buffer, size_t size, size_t flags)
+{
+	struct buffer buf = { size, 0, buffer };
+
+	if (json_msgpack_dump_callback(json, dump_to_buffer, (void *)&buf, flags))
+		return 0;
+
+	return buf.used;
+}
+
+/*** decoding ***/
+
+typedef struct {
+	const unsigned char *data;
+	size_t length;
+	size_t position;
+	size_t flags;
+	size_t depth;
+	json_error_t *error;
+} msgpack_reader_t;
+
+static void msgpack_error(msgpack_reader_t *reader, const char *msg)
+{
+	jsonp_error_set(reader->error, -1, -1, reader->position, "%s", msg);
+}
+
+static int msgpack_read_uint(msgpack_reader_t *reader, int width, uint64_t *value)
+{
+	int i;
+
+	if (reader->length - reader->position < (size_t)width) {
+		msgpack_error(reader, "unexpected end of input");
+		return -1;
+	}
+
+	*value = 0;
+	for (i = 0; i < width; i++)
+		*value = (*value << 8) | reader->data[reader->position++];
+	return 0;
+}
+
+static const char *msgpack_read_bytes(msgpack_reader_t *reader, uint64_t length)
+{
+	const char *bytes;
+
+	if ((uint64_t)(reader->length - reader->position) < length) {
+		msgpack_error(reader, "unexpected end of input");
+		return NULL;
+	}
+
+	bytes = (const char *)reader->data + reader->position;
+	reader->position += (size_t)length;
+	return bytes;
+}
+
+static json_t *msgpack_parse(msgpack_reader_t *reader);
+
+static json_t *msgpack_parse_string(msgpack_reader_t *reader, uint64_t length)
+{
+	const char *bytes;
+	char *value;
+
+	bytes = msgpack_read_bytes(reader, length);
+	if (!bytes)
+		return NULL;
+
+	if (!utf8_check_string(bytes, (size_t)length)) {
+		msgpack_error(reader, "invalid UTF-8 in string");
+		return NULL;
+	}
+
+	if (!(reader->flags & JSON_ALLOW_NUL) && memchr(bytes, '\0', (size_t)length)) {
+		msgpack_error(reader, "\\u0000 is not allowed without JSON_ALLOW_NUL");
+		return NULL;
+	}
+
+	value = jsonp_strndup(bytes, (size_t)length);
+	if (!value) {
+		msgpack_error(reader, "out of memory");
+		return NULL;
+	}
+
+	return jsonp_stringn_nocheck_own(value, (size_t)length);
+}
+
+static json_t *msgpack_parse_array(msgpack_reader_t *reader, uint64_t count)
+{
+	json_t *array;
+	uint64_t i;
+
+	array = json_array();
+	if (!array)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		json_t *value = msgpack_parse(reader);
+		if (!value || json_array_append_new(array, value)) {
+			json_decref(array);
+			return NULL;
+		}
+	}
+
+	return array;
+}
+
+static json_t *msgpack_parse_object(msgpack_reader_t *reader, uint64_t count)
+{
+	char key_buffer[MSGPACK_KEY_BUFFER_SIZE];
+	json_t *object;
+	uint64_t i;
+
+	object = json_object();
+	if (!object)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		uint64_t length;
+		const char *bytes;
+		unsigned char type;
+		char *key;
+		json_t *value;
+
+		if (reader->position >= reader->length) {
+			msgpack_error(reader, "unexpected end of input");
+			goto error;
+		}
+
+		type = reader->data[reader->position++];
+		if ((type & 0xe0) == 0xa0)
+			length = type & 0x1f;
+		else if (type < 0xd9 || type > 0xdb ||
+			msgpack_read_uint(reader, 1 << (type - 0xd9), &length)) {
+			msgpack_error(reader, "string key expected");
+			goto error;
+		}
+
+		bytes = msgpack_read_bytes(reader, length);
+		if (!bytes)
+			goto error;
+
+		if (memchr(bytes, '\0', (size_t)length)) {
+			msgpack_error(reader, "NUL byte in object key not supported");
+			goto error;
+		}
+		if (!utf8_check_string(bytes, (size_t)length)) {
+			msgpack_error(reader, "invalid UTF-8 in object key");
+			goto error;
+		}
+
+		if (length < sizeof(key_buffer)) {
+			key = key_buffer;
+			memcpy(key, bytes, (size_t)length);
+			key[length] = '\0';
+		}
+		else {
+			key = jsonp_strndup(bytes, (size_t)length);
+			if (!key) {
+				msgpack_error(reader, "out of memory");
+				goto error;
+			}
+		}
+
+		if ((reader->flags & JSON_REJECT_DUPLICATES) && json_object_get(object, key)) {
+			msgpack_error(reader, "duplicate object key");
+			if (key != key_buffer)
+				jsonp_free(key);
+			goto error;
+		}
+
+		value = msgpack_parse(reader);
+		if (!value || json_object_set_new_nocheck(object, key, value)) {
+			if (key != key_buffer)
+				jsonp_free(key);
+			goto error;
+		}
+
+		if (key != key_buffer)
+			jsonp_free(key);
+	}
+
+	return object;
+
+error:
+	json_decref(object);
+	return NULL;
+}
+
+static json_t *msgpack_parse_integer(msgpack_reader_t *reader, json_int_t value)
+{
+	if (reader->flags & JSON_DECODE_INT_AS_REAL)
+		return json_real((double)value);
+	return json_integer(value);
+}
+
+static json_t *msgpack_parse_real(msgpack_reader_t *reader, double value)
+{
+	/* value - value is NaN for NaN and both infinities, which JSON can't hold */
+	if (value - value != value - value) {
+		msgpack_error(reader, "unsupported non-finite real");
+		return NULL;
+	}
+	return json_real(value);
+}
+
+static json_t *msgpack_parse_value(msgpack_reader_t *reader)
+{
+	uint64_t value;
+	unsigned char type;
+
+	if (reader->position >= reader->length) {
+		msgpack_error(reader, "unexpected end of input");
+		return NULL;
+	}
+
+	type = reader->data[reader->position++];
+
+	/* fixed size types, with the value or length in the type byte */
+	if (type <= 0x7f)
+		return msgpack_parse_integer(reader, type);
+	if (type >= 0xe0)
+		return msgpack_parse_integer(reader, (json_int_t)type - 0x100);
+	if ((type & 0xf0) == 0x80)
+		return msgpack_parse_object(reader, type & 0x0f);
+	if ((type & 0xf0) == 0x90)
+		return msgpack_parse_array(reader, type & 0x0f);
+	if ((type & 0xe0) == 0xa0)
+		return msgpack_parse_string(reader, type & 0x1f);
+
+	switch (type) {
+	case 0xc0:
+		return json_null();
+	case 0xc2:
+		return json_false();
+	case 0xc3:
+		return json_true();
+
+	case 0xc4: case 0xc5: case 0xc6:
+	{
+		const char *bytes;
+
+		if (msgpack_read_uint(reader, 1 << (type - 0xc4), &value))
+			return NULL;
+		bytes = msgpack_read_bytes(reader, value);
+		if (!bytes)
+			return NULL;
+		return json_mem(bytes, (size_t)value);
+	}
+
+	case 0xca:
+	{
+		uint64_t bits;
+		uint32_t bits32;
+		float real;
+
+		if (msgpack_read_uint(reader, 4, &bits))
+			return NULL;
+		bits32 = (uint32_t)bits;
+		memcpy(&real, &bits32, sizeof(real));
+		return msgpack_parse_real(reader, real);
+	}
+
+	case 0xcb:
+	{
+		uint64_t bits;
+		double real;
+
+		if (msgpack_read_uint(reader, 8, &bits))
+			return NULL;
+		memcpy(&real, &bits, sizeof(real));
+		return msgpack_parse_real(reader, real);
+	}
+
+	case 0xcc: case 0xcd: case 0xce: case 0xcf:
+		if (msgpack_read_uint(reader, 1 << (type - 0xcc), &value))
+			return NULL;
+		if (value > (uint64_t)MSGPACK_INTEGER_MAX) {
+			msgpack_error(reader, "too big integer");
+			return NULL;
+		}
+		return msgpack_parse_integer(reader, (json_int_t)value);
+
+	case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+	{
+		int width = 1 << (type - 0xd0);
+
+		if (msgpack_read_uint(reader, width, &value))
+			return NULL;
+		/* sign extend */
+		if (width < 8 && (value & (1ULL << (width * 8 - 1))))
+			value |= ~0ULL << (width * 8);
+		return msgpack_parse_integer(reader, (json_int_t)value);
+	}
+
+	case 0xd9: case 0xda: case 0xdb:
+		if (msgpack_read_uint(reader, 1 << (type - 0xd9), &value))
+			return NULL;
+		return msgpack_parse_string(reader, value);
+
+	case 0xdc: case 0xdd:
+		if (msgpack_read_uint(reader, type == 0xdc ? 2 : 4, &value))
+			return NULL;
+		return msgpack_parse_array(reader, value);
+
+	case 0xde: case 0xdf:
+		if (msgpack_read_uint(reader, type == 0xde ? 2 : 4, &value))
+			return NULL;
+		return msgpack_parse_object(reader, value);
+
+	default:
+		reader->position--;
+		msgpack_error(reader, "unsupported MessagePack type");
+		return NULL;
+	}
+}
+
+static json_t *msgpack_parse(msgpack_reader_t *reader)
+{
+	json_t *json;
+
+	reader->depth++;
+	if (reader->depth > JSON_PARSER_MAX_DEPTH) {
+		msgpack_error(reader, "maximum parsing depth reached");
+		return NULL;
+	}
+
+	json = msgpack_parse_value(reader);
+	if (!json && reader->error && !reader->error->text[0])
+		msgpack_error(reader, "out of memory");
+
+	reader->depth--;
+	return json;
+}
+
+json_t *json_msgpack_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error)
+{
+	msgpack_reader_t reader;
+	json_t *result;
+
+	jsonp_error_init(error, "<buffer>");
+
+	if (buffer == NULL) {
+		jsonp_error_set(error, -1, -1, 0, "wrong arguments");
+		return NULL;
+	}
+
+	reader.data = (const unsigned char *)buffer;
+	reader.length = buflen;
+	reader.position = 0;
+	reader.flags = flags;
+	reader.depth = 0;
+	reader.error = error;
+
+	if (!(flags & JSON_DECODE_ANY) && buflen > 0) {
+		unsigned char type = reader.data[0];
+		if ((type & 0xe0) != 0x80 && type != 0xdc && type != 0xdd && type != 0xde && type != 0xdf) {
+			msgpack_error(&reader, "array or map expected");
+			return NULL;
+		}
+	}
+
+	result = msgpack_parse(&reader);
+	if (!result)
+		return NULL;
+
+	if (!(flags & JSON_DISABLE_EOF_CHECK) && reader.position != reader.length) {
+		msgpack_error(&reader, "end of input expected");
+		json_decref(result);
+		return NULL;
+	}
+
+	if (error) {
+		/* Save the position even though there was no error */
+		error->position = (int)reader.position;
+	}
+
+	return result;
+}
+
+/* JSON text can only start with whitespace or a printable ASCII character.
+   MessagePack arrays, maps, strings, bin and all other non integer types
+   start with a byte >= 0x80, so only a top level positive fixint in the
+   printable range (which needs JSON_DECODE_ANY) is ambiguous, and it is
+   read as JSON. */
+static int is_msgpack(const char *buffer, size_t buflen)
+{
+	unsigned char first;
+
+	if (buflen == 0)
+		return 0;
+
+	first = (unsigned char)buffer[0];
+	if (first >= 0x80)
+		return 1;
+	return first < 0x20 && first != ' ' && first != '\t' && first != '\n' && first != '\r';
+}
+
+json_t *json_loadb_auto(const char *buffer, size_t buflen, size_t flags, json_error_t *error)
+{
+	if (buffer && is_msgpack(buffer, buflen))
+		return json_msgpack_loadb(buffer, buflen, flags, error);
+	return json_loadb(buffer, buflen, flags, error);
+}
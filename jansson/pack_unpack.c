@@ -7,6 +7,10 @@
  */
 
 #include <string.h>
+#if defined(_WIN32)
+/* For InterlockedCompareExchangePointer() */
+#include <windows.h>
+#endif
 #include "jansson.h"
 #include "jansson_private.h"
 #include "utf.h"
@@ -18,9 +22,19 @@ typedef struct {
     char token;
 } token_t;
 
+/* A format string that has been split into tokens ahead of time. The
+   token array always ends with a token whose value is 0. */
+struct json_format_t {
+    const char *key;   /* the pointer this was cached under, if any */
+    char *fmt;         /* private copy of the format string */
+    size_t length;
+    token_t tokens[1];
+};
+
 typedef struct {
     const char *start;
     const char *fmt;
+    const token_t *tokens;
     token_t prev_token;
     token_t token;
     token_t next_token;
@@ -55,6 +69,7 @@ static void scanner_init(scanner_t *s, json_error_t *error,
     s->error = error;
     s->flags = flags;
     s->fmt = s->start = fmt;
+    s->tokens = NULL;
     memset(&s->prev_token, 0, sizeof(token_t));
     memset(&s->token, 0, sizeof(token_t));
     memset(&s->next_token, 0, sizeof(token_t));
@@ -74,6 +89,14 @@ static void next_token(scanner_t *s)
         return;
     }
 
+    if(s->tokens) {
+        /* precompiled, stay on the terminating token once we reach it */
+        s->token = *s->tokens;
+        if(s->tokens->token)
+            s->tokens++;
+        return;
+    }
+
     t = s->fmt;
     s->column++;
     s->pos++;
@@ -768,13 +791,166 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap)
     }
 }
 
-json_t *json_vpack_ex(json_error_t *error, size_t flags,
-                      const char *fmt, va_list ap)
+/*** compiled formats ***/
+
+static const char pack_format_chars[] = "{}[]snbiIfoO#%+?*";
+static const char unpack_format_chars[] = "{}[]siIbfFOon!*%?";
+
+static json_format_t *format_compile(const char *fmt, const char *allowed)
 {
     scanner_t s;
+    json_format_t *format;
+    size_t count = 0, length, i;
+
+    if(!fmt || !*fmt)
+        return NULL;
+
+    scanner_init(&s, NULL, 0, fmt);
+    do {
+        next_token(&s);
+        if(token(&s) && allowed && !strchr(allowed, token(&s)))
+            return NULL;
+        count++;
+    } while(token(&s));
+
+    length = strlen(fmt);
+    format = jsonp_malloc(offsetof(json_format_t, tokens) +
+                          count * sizeof(token_t));
+    if(!format)
+        return NULL;
+
+    format->fmt = jsonp_strndup(fmt, length);
+    if(!format->fmt) {
+        jsonp_free(format);
+        return NULL;
+    }
+    format->key = NULL;
+    format->length = length;
+
+    scanner_init(&s, NULL, 0, fmt);
+    for(i = 0; i < count; i++) {
+        next_token(&s);
+        format->tokens[i] = s.token;
+    }
+
+    return format;
+}
+
+json_format_t *json_pack_compile(const char *fmt)
+{
+    return format_compile(fmt, pack_format_chars);
+}
+
+json_format_t *json_unpack_compile(const char *fmt)
+{
+    return format_compile(fmt, unpack_format_chars);
+}
+
+void json_format_free(json_format_t *format)
+{
+    /* cached formats are shared and live as long as the process */
+    if(!format || format->key)
+        return;
+
+    jsonp_free(format->fmt);
+    jsonp_free(format);
+}
+
+/*
+ * Formats used through json_pack() and json_unpack() are compiled and
+ * cached by the address of the format string, which is almost always a
+ * literal. Each hit is checked against the cached copy of the string, so
+ * a reused buffer with different contents just misses. Slots are filled
+ * once and never replaced or freed, which keeps lookups lock free. A
+ * format that misses is scanned directly rather than compiled for a
+ * single use.
+ */
+#define FORMAT_CACHE_SIZE 256
+
+static json_format_t *volatile format_cache[FORMAT_CACHE_SIZE];
+
+static json_format_t *format_cache_load(json_format_t *volatile *slot)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+    return *slot;
+#endif
+}
+
+static int format_cache_publish(json_format_t *volatile *slot, json_format_t *format)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __sync_bool_compare_and_swap(slot, NULL, format);
+#elif defined(_WIN32)
+    return InterlockedCompareExchangePointer((PVOID volatile *)slot, format, NULL) == NULL;
+#else
+    /* no way to publish safely, don't cache */
+    return 0;
+#endif
+}
+
+/* Returns the cached compiled version of fmt, or NULL if it isn't cached
+   and the caller should scan fmt directly */
+static const json_format_t *format_cache_get(const char *fmt)
+{
+    json_format_t *volatile *slot;
+    json_format_t *format;
+    uintptr_t key = (uintptr_t)fmt;
+
+    slot = &format_cache[((key >> 3) ^ (key >> 11)) % FORMAT_CACHE_SIZE];
+    format = format_cache_load(slot);
+    if(format) {
+        if(format->key == fmt && !strncmp(format->fmt, fmt, format->length + 1))
+            return format;
+        /* slot taken by another format */
+        return NULL;
+    }
+
+    format = format_compile(fmt, NULL);
+    if(!format)
+        return NULL;
+
+    format->key = fmt;
+    if(!format_cache_publish(slot, format)) {
+        /* another thread filled the slot first */
+        format->key = NULL;
+        json_format_free(format);
+        return NULL;
+    }
+    return format;
+}
+
+static json_t *do_vpack(scanner_t *s, va_list ap)
+{
     va_list ap_copy;
     json_t *value;
 
+    next_token(s);
+
+    va_copy(ap_copy, ap);
+    value = pack(s, &ap_copy);
+    va_end(ap_copy);
+
+    if(!value)
+        return NULL;
+
+    next_token(s);
+    if(token(s)) {
+        json_decref(value);
+        set_error(s, "<format>", "Garbage after format string");
+        return NULL;
+    }
+
+    return value;
+}
+
+json_t *json_vpack_ex(json_error_t *error, size_t flags,
+                      const char *fmt, va_list ap)
+{
+    scanner_t s;
+    const json_format_t *format;
+
     if(!fmt || !*fmt) {
         jsonp_error_init(error, "<format>");
         jsonp_error_set(error, -1, -1, 0, "NULL or empty format string");
@@ -783,21 +959,41 @@ json_t *json_vpack_ex(json_error_t *error, size_t flags,
     jsonp_error_init(error, NULL);
 
     scanner_init(&s, error, flags, fmt);
-    next_token(&s);
 
-    va_copy(ap_copy, ap);
-    value = pack(&s, &ap_copy);
-    va_end(ap_copy);
+    /* formats that aren't cached are scanned directly */
+    format = format_cache_get(fmt);
+    if(format)
+        s.tokens = format->tokens;
 
-    if(!value)
-        return NULL;
+    return do_vpack(&s, ap);
+}
 
-    next_token(&s);
-    if(token(&s)) {
-        json_decref(value);
-        set_error(&s, "<format>", "Garbage after format string");
+json_t *json_vpack_format_ex(json_error_t *error, size_t flags,
+                             const json_format_t *format, va_list ap)
+{
+    scanner_t s;
+
+    if(!format) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, "NULL format");
         return NULL;
     }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, flags, format->fmt);
+    s.tokens = format->tokens;
+
+    return do_vpack(&s, ap);
+}
+
+json_t *json_pack_format(const json_format_t *format, ...)
+{
+    json_t *value;
+    va_list ap;
+
+    va_start(ap, format);
+    value = json_vpack_format_ex(NULL, 0, format, ap);
+    va_end(ap);
 
     return value;
 }
@@ -826,11 +1022,33 @@ json_t *json_pack(const char *fmt, ...)
     return value;
 }
 
+static int do_vunpack(scanner_t *s, json_t *root, va_list ap)
+{
+    va_list ap_copy;
+
+    next_token(s);
+
+    va_copy(ap_copy, ap);
+    if(unpack(s, root, &ap_copy)) {
+        va_end(ap_copy);
+        return -1;
+    }
+    va_end(ap_copy);
+
+    next_token(s);
+    if(token(s)) {
+        set_error(s, "<format>", "Garbage after format string");
+        return -1;
+    }
+
+    return 0;
+}
+
 int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags,
                     const char *fmt, va_list ap)
 {
     scanner_t s;
-    va_list ap_copy;
+    const json_format_t *format;
 
     if(!root) {
         jsonp_error_init(error, "<root>");
@@ -846,22 +1064,49 @@ int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags,
     jsonp_error_init(error, NULL);
 
     scanner_init(&s, error, flags, fmt);
-    next_token(&s);
 
-    va_copy(ap_copy, ap);
-    if(unpack(&s, root, &ap_copy)) {
-        va_end(ap_copy);
+    /* formats that aren't cached are scanned directly */
+    format = format_cache_get(fmt);
+    if(format)
+        s.tokens = format->tokens;
+
+    return do_vunpack(&s, root, ap);
+}
+
+int json_vunpack_format_ex(json_t *root, json_error_t *error, size_t flags,
+                           const json_format_t *format, va_list ap)
+{
+    scanner_t s;
+
+    if(!root) {
+        jsonp_error_init(error, "<root>");
+        jsonp_error_set(error, -1, -1, 0, "NULL root value");
         return -1;
     }
-    va_end(ap_copy);
 
-    next_token(&s);
-    if(token(&s)) {
-        set_error(&s, "<format>", "Garbage after format string");
+    if(!format) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, "NULL format");
         return -1;
     }
+    jsonp_error_init(error, NULL);
 
-    return 0;
+    scanner_init(&s, error, flags, format->fmt);
+    s.tokens = format->tokens;
+
+    return do_vunpack(&s, root, ap);
+}
+
+int json_unpack_format(json_t *root, const json_format_t *format, ...)
+{
+    int ret;
+    va_list ap;
+
+    va_start(ap, format);
+    ret = json_vunpack_format_ex(root, NULL, 0, format, ap);
+    va_end(ap);
+
+    return ret;
 }
 
 int json_unpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt, ...)
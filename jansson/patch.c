@@ -0,0 +1,494 @@
+/*
+ * JSON Patch (RFC 6902) generation and application.
+ *
+ * json_diff() walks two values in parallel and emits add, remove and replace
+ * operations for the parts that differ.  It hashes both documents up front,
+ * which caches a structural hash on every container, so the json_equal()
+ * check on each pair of subtrees rejects mismatches without walking them and
+ * only the changed paths of large documents are visited.  Arrays
+ * are diffed by trimming their common prefix and suffix and then walking the
+ * rest in step, looking a bounded distance ahead to realign after inserted
+ * or removed runs.  That keeps patches for typical edits small without the
+ * cost of a full LCS.
+ *
+ * json_patch_apply() applies every operation to a deep copy of the document,
+ * so the patch is atomic and never modifies the caller's document.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "strbuffer.h"
+
+/* How far ahead json_diff() looks for a match when the elements of two
+   arrays stop lining up */
+#define DIFF_LOOKAHEAD 16
+
+/*** diff ***/
+
+static int diff_append_token(strbuffer_t *path, const char *token)
+{
+	if (strbuffer_append_byte(path, '/'))
+		return -1;
+
+	for (; *token; token++) {
+		int ret;
+
+		if (*token == '~')
+			ret = strbuffer_append_bytes(path, "~0", 2);
+		else if (*token == '/')
+			ret = strbuffer_append_bytes(path, "~1", 2);
+		else
+			ret = strbuffer_append_byte(path, *token);
+		if (ret)
+			return -1;
+	}
+	return 0;
+}
+
+static int diff_append_index(strbuffer_t *path, size_t index)
+{
+	char buffer[32];
+
+	snprintf(buffer, sizeof(buffer), "%zu", index);
+	return diff_append_token(path, buffer);
+}
+
+static void diff_truncate(strbuffer_t *path, size_t length)
+{
+	path->length = length;
+	path->value[length] = '\0';
+}
+
+static int diff_op(json_t *patch, const char *op, const char *path, json_t *value)
+{
+	json_t *operation;
+
+	operation = json_object();
+	if (!operation)
+		return -1;
+
+	if (json_object_set_new_nocheck(operation, "op", json_string_nocheck(op)) ||
+		json_object_set_new_nocheck(operation, "path", json_string(path)) ||
+		(value && json_object_set_nocheck(operation, "value", value)) ||
+		json_array_append_new(patch, operation))
+		return -1;
+
+	return 0;
+}
+
+static int do_diff(json_t *patch, strbuffer_t *path, json_t *old, json_t *new);
+
+static int diff_object(json_t *patch, strbuffer_t *path, json_t *old, json_t *new)
+{
+	size_t length = path->length;
+	const char *key;
+	json_t *value;
+
+	json_object_foreach(old, key, value) {
+		json_t *new_value = json_object_get(new, key);
+
+		if (diff_append_token(path, key))
+			return -1;
+		if (!new_value) {
+			if (diff_op(patch, "remove", strbuffer_value(path), NULL))
+				return -1;
+		}
+		else if (do_diff(patch, path, value, new_value))
+			return -1;
+		diff_truncate(path, length);
+	}
+
+	json_object_foreach(new, key, value) {
+		if (json_object_get(old, key))
+			continue;
+
+		if (diff_append_token(path, key) ||
+			diff_op(patch, "add", strbuffer_value(path), value))
+			return -1;
+		diff_truncate(path, length);
+	}
+
+	return 0;
+}
+
+static int diff_array(json_t *patch, strbuffer_t *path, json_t *old, json_t *new)
+{
+	size_t length = path->length;
+	size_t old_size = json_array_size(old), new_size = json_array_size(new);
+	size_t prefix = 0, suffix = 0, i, j;
+
+	while (prefix < old_size && prefix < new_size &&
+		json_equal(json_array_get(old, prefix), json_array_get(new, prefix)))
+		prefix++;
+
+	while (suffix < old_size - prefix && suffix < new_size - prefix &&
+		json_equal(json_array_get(old, old_size - suffix - 1), json_array_get(new, new_size - suffix - 1)))
+		suffix++;
+
+	old_size -= prefix + suffix;
+	new_size -= prefix + suffix;
+
+	/* i indexes the old elements and j the new ones.  Once the operations for
+	   the elements before them are applied, the array matches the new one up
+	   to j, so every operation is at index prefix + j. */
+	i = j = 0;
+	while (i < old_size || j < new_size) {
+		json_t *old_value = i < old_size ? json_array_get(old, prefix + i) : NULL;
+		json_t *new_value = j < new_size ? json_array_get(new, prefix + j) : NULL;
+		size_t removed = 0, added = 0, k;
+
+		if (old_value && new_value) {
+			if (json_equal(old_value, new_value)) {
+				i++;
+				j++;
+				continue;
+			}
+
+			/* look a little ahead for where the arrays line up again */
+			for (k = 1; !removed && k <= DIFF_LOOKAHEAD && old_size - i - k >= new_size - j &&
+				i + k < old_size; k++) {
+				if (json_equal(json_array_get(old, prefix + i + k), new_value))
+					removed = k;
+			}
+			for (k = 1; !removed && !added && k <= DIFF_LOOKAHEAD && new_size - j - k >= old_size - i &&
+				j + k < new_size; k++) {
+				if (json_equal(old_value, json_array_get(new, prefix + j + k)))
+					added = k;
+			}
+
+			if (!removed && !added) {
+				if (diff_append_index(path, prefix + j) ||
+					do_diff(patch, path, old_value, new_value))
+					return -1;
+				diff_truncate(path, length);
+				i++;
+				j++;
+				continue;
+			}
+		}
+		else if (old_value)
+			removed = 1;
+		else
+			added = 1;
+
+		/* removing at the same index repeatedly drops a run of elements */
+		for (; removed; removed--, i++) {
+			if (diff_append_index(path, prefix + j) ||
+				diff_op(patch, "remove", strbuffer_value(path), NULL))
+				return -1;
+			diff_truncate(path, length);
+		}
+		for (; added; added--, j++) {
+			if (diff_append_index(path, prefix + j) ||
+				diff_op(patch, "add", strbuffer_value(path), json_array_get(new, prefix + j)))
+				return -1;
+			diff_truncate(path, length);
+		}
+	}
+
+	return 0;
+}
+
+static int do_diff(json_t *patch, strbuffer_t *path, json_t *old, json_t *new)
+{
+	if (old == new || json_equal(old, new))
+		return 0;
+
+	if (json_is_object(old) && json_is_object(new))
+		return diff_object(patch, path, old, new);
+
+	if (json_is_array(old) && json_is_array(new))
+		return diff_array(patch, path, old, new);
+
+	return diff_op(patch, "replace", strbuffer_value(path), new);
+}
+
+json_t *json_diff(json_t *old, json_t *new)
+{
+	strbuffer_t path;
+	json_t *patch;
+
+	if (!old || !new)
+		return NULL;
+
+	patch = json_array();
+	if (!patch)
+		return NULL;
+
+	if (strbuffer_init(&path)) {
+		json_decref(patch);
+		return NULL;
+	}
+
+	/* cache the hashes that json_equal() rejects mismatched subtrees by */
+	json_hash(old);
+	json_hash(new);
+
+	if (do_diff(patch, &path, old, new)) {
+		json_decref(patch);
+		patch = NULL;
+	}
+
+	strbuffer_close(&path);
+	return patch;
+}
+
+/*** apply ***/
+
+/* Copies the next reference token of a JSON pointer into token, undoing the
+   ~0 and ~1 escapes, and returns a pointer past it, or NULL if it's invalid */
+static const char *pointer_next_token(const char *pointer, strbuffer_t *token)
+{
+	strbuffer_clear(token);
+
+	for (; *pointer && *pointer != '/'; pointer++) {
+		char c = *pointer;
+
+		if (c == '~') {
+			pointer++;
+			if (*pointer == '0')
+				c = '~';
+			else if (*pointer == '1')
+				c = '/';
+			else
+				return NULL;
+		}
+		if (strbuffer_append_byte(token, c))
+			return NULL;
+	}
+	return pointer;
+}
+
+/* Parses an array index token.  "-" refers to the element after the last one,
+   which is only valid when appending. */
+static int pointer_index(const char *token, size_t size, int allow_end, size_t *index)
+{
+	char *end;
+	unsigned long long value;
+
+	if (allow_end && strcmp(token, "-") == 0) {
+		*index = size;
+		return 0;
+	}
+
+	if (*token < '0' || *token > '9' || (token[0] == '0' && token[1]))
+		return -1;
+
+	value = strtoull(token, &end, 10);
+	if (*end || value > size || (!allow_end && value == size))
+		return -1;
+
+	*index = (size_t)value;
+	return 0;
+}
+
+/* Looks up the value a JSON pointer refers to */
+static json_t *pointer_get(json_t *root, const char *pointer, strbuffer_t *token)
+{
+	json_t *json = root;
+
+	if (*pointer && *pointer != '/')
+		return NULL;
+
+	while (json && *pointer) {
+		size_t index;
+
+		pointer = pointer_next_token(pointer + 1, token);
+		if (!pointer)
+			return NULL;
+
+		if (json_is_object(json))
+			json = json_object_get(json, strbuffer_value(token));
+		else if (json_is_array(json)) {
+			if (pointer_index(strbuffer_value(token), json_array_size(json), 0, &index))
+				return NULL;
+			json = json_array_get(json, index);
+		}
+		else
+			return NULL;
+	}
+	return json;
+}
+
+/* Finds the container holding the last token of a JSON pointer, leaving the
+   last token in token */
+static json_t *pointer_get_parent(json_t *root, const char *pointer, strbuffer_t *token)
+{
+	const char *last = strrchr(pointer, '/');
+	json_t *parent;
+	char *prefix;
+
+	if (!last)
+		return NULL;
+
+	prefix = jsonp_strndup(pointer, last - pointer);
+	if (!prefix)
+		return NULL;
+	parent = pointer_get(root, prefix, token);
+	jsonp_free(prefix);
+
+	if (!parent || !pointer_next_token(last + 1, token))
+		return NULL;
+	return parent;
+}
+
+/* Adds value (stealing the reference) at pointer.  *root is replaced when the
+   pointer refers to the whole document. */
+static int patch_add(json_t **root, const char *pointer, json_t *value, strbuffer_t *token)
+{
+	json_t *parent;
+	size_t index;
+
+	if (!value)
+		return -1;
+
+	if (!*pointer) {
+		json_decref(*root);
+		*root = value;
+		return 0;
+	}
+
+	parent = pointer_get_parent(*root, pointer, token);
+	if (json_is_object(parent))
+		return json_object_set_new(parent, strbuffer_value(token), value);
+	if (json_is_array(parent) &&
+		!pointer_index(strbuffer_value(token), json_array_size(parent), 1, &index))
+		return json_array_insert_new(parent, index, value);
+
+	json_decref(value);
+	return -1;
+}
+
+/* Removes the value at pointer, returning a reference to it in removed if
+   that isn't NULL */
+static int patch_remove(json_t *root, const char *pointer, json_t **removed, strbuffer_t *token)
+{
+	json_t *parent, *value;
+	size_t index;
+
+	parent = pointer_get_parent(root, pointer, token);
+	if (json_is_object(parent)) {
+		value = json_object_get(parent, strbuffer_value(token));
+		if (!value)
+			return -1;
+		if (removed)
+			*removed = json_incref(value);
+		return json_object_del(parent, strbuffer_value(token));
+	}
+	if (json_is_array(parent) &&
+		!pointer_index(strbuffer_value(token), json_array_size(parent), 0, &index)) {
+		if (removed)
+			*removed = json_incref(json_array_get(parent, index));
+		return json_array_remove(parent, index);
+	}
+	return -1;
+}
+
+static int patch_replace(json_t **root, const char *pointer, json_t *value, strbuffer_t *token)
+{
+	json_t *parent;
+	size_t index;
+
+	if (!value)
+		return -1;
+
+	if (!*pointer) {
+		json_decref(*root);
+		*root = value;
+		return 0;
+	}
+
+	parent = pointer_get_parent(*root, pointer, token);
+	if (json_is_object(parent) && json_object_get(parent, strbuffer_value(token)))
+		return json_object_set_new(parent, strbuffer_value(token), value);
+	if (json_is_array(parent) &&
+		!pointer_index(strbuffer_value(token), json_array_size(parent), 0, &index))
+		return json_array_set_new(parent, index, value);
+
+	json_decref(value);
+	return -1;
+}
+
+static int patch_operation(json_t **root, json_t *operation, strbuffer_t *token)
+{
+	const char *op, *path, *from;
+	json_t *value;
+
+	op = json_string_value(json_object_get(operation, "op"));
+	path = json_string_value(json_object_get(operation, "path"));
+	value = json_object_get(operation, "value");
+	from = json_string_value(json_object_get(operation, "from"));
+	if (!op || !path)
+		return -1;
+
+	if (strcmp(op, "add") == 0)
+		return patch_add(root, path, json_deep_copy(value), token);
+
+	if (strcmp(op, "remove") == 0)
+		return patch_remove(*root, path, NULL, token);
+
+	if (strcmp(op, "replace") == 0)
+		return patch_replace(root, path, json_deep_copy(value), token);
+
+	if (strcmp(op, "test") == 0) {
+		json_t *target = pointer_get(*root, path, token);
+		return value && target && json_equal(target, value) ? 0 : -1;
+	}
+
+	if (strcmp(op, "copy") == 0) {
+		if (!from)
+			return -1;
+		return patch_add(root, path, json_deep_copy(pointer_get(*root, from, token)), token);
+	}
+
+	if (strcmp(op, "move") == 0) {
+		size_t from_length;
+		json_t *moved;
+
+		if (!from)
+			return -1;
+
+		/* a value can't be moved into one of its own children */
+		from_length = strlen(from);
+		if (strncmp(path, from, from_length) == 0 && path[from_length] == '/')
+			return -1;
+		if (strcmp(path, from) == 0)
+			return pointer_get(*root, from, token) ? 0 : -1;
+
+		if (!*from || patch_remove(*root, from, &moved, token))
+			return -1;
+		return patch_add(root, path, moved, token);
+	}
+
+	return -1;
+}
+
+json_t *json_patch_apply(json_t *doc, json_t *patch)
+{
+	strbuffer_t token;
+	json_t *result;
+	size_t i;
+
+	if (!doc || !json_is_array(patch))
+		return NULL;
+
+	if (strbuffer_init(&token))
+		return NULL;
+
+	result = json_deep_copy(doc);
+	for (i = 0; result && i < json_array_size(patch); i++) {
+		json_t *operation = json_array_get(patch, i);
+
+		if (!json_is_object(operation) || patch_operation(&result, operation, &token)) {
+			json_decref(result);
+			result = NULL;
+		}
+	}
+
+	strbuffer_close(&token);
+	return result;
+}
@@ -0,0 +1,256 @@
+/*
+ * Compiled JSON pointers (RFC 6901).
+ *
+ * json_path_compile() splits a pointer into its reference tokens once,
+ * undoing the ~0 and ~1 escapes and hashing every key, so repeated lookups
+ * with json_path_get() go straight to the hash buckets.  A path is a single
+ * allocation holding the tokens and their keys.
+ *
+ * A json_filter_t merges several paths into a trie, which the filtered
+ * loaders in load.c follow to decide which values to build and which to
+ * skip.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+static int path_token_index(const char *key, size_t length, size_t *index)
+{
+	size_t i, value = 0;
+
+	if (length == 0 || (key[0] == '0' && length > 1))
+		return 0;
+
+	for (i = 0; i < length; i++) {
+		if (key[i] < '0' || key[i] > '9')
+			return 0;
+		if (value > ((size_t)-1 - 9) / 10)
+			return 0;
+		value = value * 10 + (size_t)(key[i] - '0');
+	}
+
+	*index = value;
+	return 1;
+}
+
+json_path_t *json_path_compile(const char *pointer)
+{
+	json_path_t *path;
+	const char *p;
+	char *keys;
+	size_t count = 0, size, i;
+
+	if (!pointer || (*pointer && *pointer != '/'))
+		return NULL;
+
+	for (p = pointer; *p; p++) {
+		if (*p == '/')
+			count++;
+		else if (*p == '~' && p[1] != '0' && p[1] != '1')
+			return NULL;
+	}
+
+	/* the unescaped keys are never longer than the pointer */
+	size = sizeof(json_path_t) + count * sizeof(json_path_token_t) + strlen(pointer) + 1;
+	path = jsonp_malloc(size);
+	if (!path)
+		return NULL;
+
+	path->count = count;
+	keys = (char *)&path->tokens[count];
+
+	p = pointer;
+	for (i = 0; i < count; i++) {
+		json_path_token_t *token = &path->tokens[i];
+
+		token->key = keys;
+		for (p++; *p && *p != '/'; p++) {
+			if (*p == '~') {
+				p++;
+				*keys++ = *p == '0' ? '~' : '/';
+			}
+			else
+				*keys++ = *p;
+		}
+		*keys++ = '\0';
+
+		token->length = keys - token->key - 1;
+		token->hash = jsonp_hash_bytes(token->key, token->length);
+		token->is_index = path_token_index(token->key, token->length, &token->index);
+	}
+
+	return path;
+}
+
+void json_path_free(json_path_t *path)
+{
+	jsonp_free(path);
+}
+
+json_t *json_path_get(json_t *root, const json_path_t *path)
+{
+	json_t *json = root;
+	size_t i;
+
+	if (!path)
+		return NULL;
+
+	for (i = 0; json && i < path->count; i++) {
+		const json_path_token_t *token = &path->tokens[i];
+
+		if (json_is_object(json))
+			json = jsonp_object_get_hashed(json, token->key, token->hash);
+		else if (json_is_array(json) && token->is_index)
+			json = json_array_get(json, token->index);
+		else
+			return NULL;
+	}
+
+	return json;
+}
+
+/*** load filters ***/
+
+static void filter_node_free(json_filter_node_t *node)
+{
+	size_t i;
+
+	for (i = 0; i < node->count; i++)
+		filter_node_free(&node->children[i]);
+	jsonp_free(node->children);
+}
+
+void json_filter_free(json_filter_t *filter)
+{
+	size_t i;
+
+	if (!filter)
+		return;
+
+	filter_node_free(&filter->root);
+	for (i = 0; i < filter->path_count; i++)
+		json_path_free(filter->paths[i]);
+	jsonp_free(filter->paths);
+	jsonp_free(filter);
+}
+
+static json_filter_node_t *filter_add_child(json_filter_node_t *node, const json_path_token_t *token)
+{
+	json_filter_node_t *children;
+	size_t i;
+
+	for (i = 0; i < node->count; i++) {
+		if (node->children[i].token.length == token->length &&
+			memcmp(node->children[i].token.key, token->key, token->length) == 0)
+			return &node->children[i];
+	}
+
+	children = jsonp_malloc((node->count + 1) * sizeof(json_filter_node_t));
+	if (!children)
+		return NULL;
+	if (node->count)
+		memcpy(children, node->children, node->count * sizeof(json_filter_node_t));
+	jsonp_free(node->children);
+	node->children = children;
+
+	memset(&children[node->count], 0, sizeof(json_filter_node_t));
+	children[node->count].token = *token;
+	return &children[node->count++];
+}
+
+/* Compiles a filter path, which is either a JSON pointer or a plain top
+   level key */
+static json_path_t *filter_path_compile(const char *key)
+{
+	json_path_t *path;
+	char *pointer, *p;
+
+	if (*key == '/' || *key == '\0')
+		return json_path_compile(key);
+
+	pointer = jsonp_malloc(strlen(key) * 2 + 2);
+	if (!pointer)
+		return NULL;
+
+	p = pointer;
+	*p++ = '/';
+	for (; *key; key++) {
+		if (*key == '~' || *key == '/') {
+			*p++ = '~';
+			*p++ = *key == '~' ? '0' : '1';
+		}
+		else
+			*p++ = *key;
+	}
+	*p = '\0';
+
+	path = json_path_compile(pointer);
+	jsonp_free(pointer);
+	return path;
+}
+
+json_filter_t *json_filter_create(const char **paths, size_t count)
+{
+	json_filter_t *filter;
+	size_t i, j;
+
+	if (!paths)
+		return NULL;
+
+	filter = jsonp_malloc(sizeof(json_filter_t));
+	if (!filter)
+		return NULL;
+	memset(filter, 0, sizeof(json_filter_t));
+
+	filter->paths = jsonp_malloc((count ? count : 1) * sizeof(json_path_t *));
+	if (!filter->paths)
+		goto error;
+
+	for (i = 0; i < count; i++) {
+		json_filter_node_t *node = &filter->root;
+		json_path_t *path;
+
+		path = paths[i] ? filter_path_compile(paths[i]) : NULL;
+		if (!path)
+			goto error;
+		filter->paths[filter->path_count++] = path;
+
+		for (j = 0; node && j < path->count; j++)
+			node = filter_add_child(node, &path->tokens[j]);
+		if (!node)
+			goto error;
+		node->keep = 1;
+	}
+
+	return filter;
+
+error:
+	json_filter_free(filter);
+	return NULL;
+}
+
+const json_filter_node_t *jsonp_filter_child(const json_filter_node_t *node, const char *key, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < node->count; i++) {
+		if (node->children[i].token.length == length &&
+			memcmp(node->children[i].token.key, key, length) == 0)
+			return &node->children[i];
+	}
+	return NULL;
+}
+
+const json_filter_node_t *jsonp_filter_index(const json_filter_node_t *node, size_t index)
+{
+	size_t i;
+
+	for (i = 0; i < node->count; i++) {
+		if (node->children[i].token.is_index && node->children[i].token.index == index)
+			return &node->children[i];
+	}
+	return NULL;
+}
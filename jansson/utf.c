@@ -162,13 +162,28 @@ const char *utf8_iterate(const char *buffer, size_t bufsize, int32_t *codepoint)
     return buffer + count;
 }
 
-int utf8_check_string(const char *string, size_t length)
+/* Validates one sequence at a time, skipping over runs of ASCII a word at
+   a time */
+static int utf8_check_string_scalar(const char *string, size_t length)
 {
-    size_t i;
+    size_t i = 0;
 
-    for(i = 0; i < length; i++)
+    while(i < length)
     {
-        size_t count = utf8_check_first(string[i]);
+        size_t count;
+
+        while(length - i >= sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, &string[i], sizeof(word));
+            if(word & UINT64_C(0x8080808080808080))
+                break;
+            i += sizeof(word);
+        }
+        if(i == length)
+            break;
+
+        count = utf8_check_first(string[i]);
         if(count == 0)
             return 0;
         else if(count > 1)
@@ -178,10 +193,207 @@ int utf8_check_string(const char *string, size_t length)
 
             if(!utf8_check_full(&string[i], count, NULL))
                 return 0;
-
-            i += count - 1;
         }
+        i += count;
     }
 
     return 1;
 }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_HAVE_SSSE3
+#endif
+
+#ifdef UTF8_HAVE_SSSE3
+#include <tmmintrin.h>
+
+/* SSSE3 validation with the lookup table approach of Keiser and Lemire,
+   "Validating UTF-8 In Less Than One Instruction Per Byte".  Every error a
+   pair of adjacent bytes can show is classified by three 16 entry tables,
+   indexed by the high and low nibbles of the first byte and the high nibble
+   of the second, and the pair is invalid if a bit survives in all three.
+   Continuations owed to 3 and 4 byte sequences are checked separately. */
+
+#define UTF8_TOO_SHORT      (1 << 0)  /* lead byte not followed by continuation */
+#define UTF8_TOO_LONG       (1 << 1)  /* ASCII followed by continuation */
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      (1 << 7)  /* continuation not owed to a 2 byte lead */
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+typedef struct {
+    __m128i error;
+    __m128i prev_input;
+    __m128i prev_incomplete;
+} utf8_simd_state_t;
+
+__attribute__((target("ssse3")))
+static __m128i utf8_high_nibbles(__m128i input)
+{
+    return _mm_and_si128(_mm_srli_epi16(input, 4), _mm_set1_epi8(0x0F));
+}
+
+__attribute__((target("ssse3")))
+static __m128i utf8_special_cases(__m128i input, __m128i prev1)
+{
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        /* 0_______ ________ */
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        /* 10______ ________ */
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        /* 1100____ ________ */
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        /* 1101____ ________ */
+        UTF8_TOO_SHORT,
+        /* 1110____ ________ */
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        /* 1111____ ________ */
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        /* ____0000 ________ */
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        /* ____0001 ________ */
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        /* ____001_ ________ */
+        UTF8_CARRY, UTF8_CARRY,
+        /* ____0100 ________ */
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        /* ____0101 ________ to ____1100 ________ */
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        /* ____1101 ________ */
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        /* ____111_ ________ */
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        /* ________ 0_______ */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        /* ________ 1000____ */
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        /* ________ 1001____ */
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE,
+        /* ________ 101_____ */
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+        /* ________ 11______ */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, utf8_high_nibbles(prev1));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table,
+                                          _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, utf8_high_nibbles(input));
+
+    return _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+}
+
+__attribute__((target("ssse3")))
+static void utf8_check_block(utf8_simd_state_t *state, __m128i input)
+{
+    __m128i prev1, prev2, prev3, special, must23;
+
+    if(!_mm_movemask_epi8(input))
+    {
+        /* all ASCII, only a sequence left open by the last block can fail */
+        state->error = _mm_or_si128(state->error, state->prev_incomplete);
+        state->prev_input = input;
+        state->prev_incomplete = _mm_setzero_si128();
+        return;
+    }
+
+    prev1 = _mm_alignr_epi8(input, state->prev_input, 15);
+    prev2 = _mm_alignr_epi8(input, state->prev_input, 14);
+    prev3 = _mm_alignr_epi8(input, state->prev_input, 13);
+
+    special = utf8_special_cases(input, prev1);
+
+    /* bytes two and three after a 3 or 4 byte lead must be continuations,
+       which the pair check above lets through as TWO_CONTS */
+    must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                          _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+
+    state->error = _mm_or_si128(state->error, _mm_xor_si128(must23, special));
+
+    /* a lead byte in the last three bytes may need the next block */
+    state->prev_incomplete = _mm_subs_epu8(input, _mm_setr_epi8(
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)));
+    state->prev_input = input;
+}
+
+__attribute__((target("ssse3")))
+static int utf8_check_string_ssse3(const char *string, size_t length)
+{
+    utf8_simd_state_t state;
+    size_t i;
+
+    state.error = _mm_setzero_si128();
+    state.prev_input = _mm_setzero_si128();
+    state.prev_incomplete = _mm_setzero_si128();
+
+    for(i = 0; length - i >= 16; i += 16)
+        utf8_check_block(&state, _mm_loadu_si128((const __m128i *)&string[i]));
+
+    if(i < length)
+    {
+        /* zero padding is ASCII, so it ends any open sequence too early */
+        char tail[16];
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, &string[i], length - i);
+        utf8_check_block(&state, _mm_loadu_si128((const __m128i *)tail));
+    }
+
+    state.error = _mm_or_si128(state.error, state.prev_incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(state.error, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif /* UTF8_HAVE_SSSE3 */
+
+typedef int (*utf8_check_string_func)(const char *string, size_t length);
+
+static int utf8_check_string_select(const char *string, size_t length);
+
+static utf8_check_string_func utf8_check_string_impl = utf8_check_string_select;
+
+/* Picks the fastest validator the processor supports on the first call.
+   Racing threads all store the same pointer, so no locking is needed. */
+static int utf8_check_string_select(const char *string, size_t length)
+{
+    utf8_check_string_func impl = utf8_check_string_scalar;
+
+#ifdef UTF8_HAVE_SSSE3
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3"))
+        impl = utf8_check_string_ssse3;
+#endif
+
+    utf8_check_string_impl = impl;
+    return impl(string, length);
+}
+
+int utf8_check_string(const char *string, size_t length)
+{
+    /* short strings, like most object keys, aren't worth the setup */
+    if(length < 16)
+        return utf8_check_string_scalar(string, length);
+
+    return utf8_check_string_impl(string, length);
+}
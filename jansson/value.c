@@ -22,6 +22,11 @@
 #include <stdint.h>
 #endif
 
+#if defined(_WIN32)
+/* For InterlockedIncrement() */
+#include <windows.h>
+#endif
+
 #include "jansson.h"
 #include "hashtable.h"
 #include "jansson_private.h"
@@ -44,6 +49,35 @@ static JSON_INLINE void json_init(json_t *json, json_type type)
 }
 
 
+/*** structural hashing ***/
+
+/* Cached container hashes are stamped with the write epoch they were
+   computed in, and json_hash() stamps every node it visits. A node can't
+   tell its parents that it changed, so a change to a node stamped with the
+   current epoch moves the epoch on, which invalidates the cached hashes.
+   Changes to nodes that aren't part of a currently hashed tree leave the
+   epoch, and every cache, alone. */
+static volatile size_t hash_epoch = 1;
+
+static void hash_invalidate(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__atomic_add_fetch(&hash_epoch, 1, __ATOMIC_RELEASE);
+#elif defined(_WIN64)
+	InterlockedIncrement64((volatile LONG64 *)&hash_epoch);
+#elif defined(_WIN32)
+	InterlockedIncrement((volatile LONG *)&hash_epoch);
+#else
+	hash_epoch++;
+#endif
+}
+
+#define value_modified(value_)                           \
+	do {                                                 \
+		if ((value_)->hash_epoch == hash_epoch)          \
+			hash_invalidate();                           \
+	} while (0)
+
 /*** object ***/
 
 extern volatile uint32_t hashtable_seed;
@@ -68,6 +102,8 @@ json_t *json_object(void)
 	}
 
 	object->visited = 0;
+	object->hash = 0;
+	object->hash_epoch = 0;
 
 	return &object->json;
 }
@@ -100,6 +136,17 @@ json_t *json_object_get(const json_t *json, const char *key)
 	return hashtable_get(&object->hashtable, key);
 }
 
+json_t *jsonp_object_get_hashed(const json_t *json, const char *key, size_t hash)
+{
+	json_object_t *object;
+
+	if (!key || !json_is_object(json))
+		return NULL;
+
+	object = json_to_object(json);
+	return hashtable_get_hashed(&object->hashtable, key, hash);
+}
+
 int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value)
 {
 	json_object_t *object;
@@ -120,6 +167,7 @@ int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value)
 		return -1;
 	}
 
+	value_modified(object);
 	return 0;
 }
 
@@ -142,6 +190,7 @@ int json_object_del(json_t *json, const char *key)
 		return -1;
 
 	object = json_to_object(json);
+	value_modified(object);
 	return hashtable_del(&object->hashtable, key);
 }
 
@@ -153,6 +202,7 @@ int json_object_clear(json_t *json)
 		return -1;
 
 	object = json_to_object(json);
+	value_modified(object);
 	hashtable_clear(&object->hashtable);
 
 	return 0;
@@ -260,6 +310,7 @@ int json_object_iter_set_new(json_t *json, void *iter, json_t *value)
 	if (!json_is_object(json) || !iter || !value)
 		return -1;
 
+	value_modified(json_to_object(json));
 	hashtable_iter_set(iter, value);
 	return 0;
 }
@@ -352,6 +403,8 @@ json_t *json_array(void)
 	}
 
 	array->visited = 0;
+	array->hash = 0;
+	array->hash_epoch = 0;
 
 	return &array->json;
 }
@@ -378,6 +431,7 @@ size_t json_array_size(const json_t *json)
 json_t *json_array_get(const json_t *json, size_t index)
 {
 	json_array_t *array;
+
 	if (!json_is_array(json))
 		return NULL;
 	array = json_to_array(json);
@@ -408,6 +462,7 @@ int json_array_set_new(json_t *json, size_t index, json_t *value)
 		return -1;
 	}
 
+	value_modified(array);
 	json_decref(array->table[index]);
 	array->table[index] = value;
 
@@ -475,6 +530,7 @@ int json_array_append_new(json_t *json, json_t *value)
 		return -1;
 	}
 
+	value_modified(array);
 	array->table[array->entries] = value;
 	array->entries++;
 
@@ -515,6 +571,7 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value)
 	else
 		array_move(array, index + 1, index, array->entries - index);
 
+	value_modified(array);
 	array->table[index] = value;
 	array->entries++;
 
@@ -532,6 +589,7 @@ int json_array_remove(json_t *json, size_t index)
 	if (index >= array->entries)
 		return -1;
 
+	value_modified(array);
 	json_decref(array->table[index]);
 
 	/* If we're removing the last element, nothing has to be moved */
@@ -551,6 +609,7 @@ int json_array_clear(json_t *json)
 	if (!json_is_array(json))
 		return -1;
 	array = json_to_array(json);
+	value_modified(array);
 
 	for (i = 0; i < array->entries; i++)
 		json_decref(array->table[i]);
@@ -572,6 +631,7 @@ int json_array_extend(json_t *json, json_t *other_json)
 	if (!json_array_grow(array, other->entries, 1))
 		return -1;
 
+	value_modified(array);
 	for (i = 0; i < other->entries; i++)
 		json_incref(other->table[i]);
 
@@ -660,6 +720,7 @@ static json_t *string_create(const char *value, size_t len, int own)
 	json_init(&string->json, JSON_STRING);
 	string->value = v;
 	string->length = len;
+	string->hash_epoch = 0;
 
 	return &string->json;
 }
@@ -729,7 +790,7 @@ static json_t *mem_create(const char *value, size_t len, int own)
 	if (own)
 		v = (char *)value;
 	else {
-		v = malloc(len);
+		v = jsonp_malloc_aligned(len, JSON_MEM_ALIGNMENT);
 		if (!v)
 			return NULL;
 		memcpy(v, value, len);
@@ -738,7 +799,7 @@ static json_t *mem_create(const char *value, size_t len, int own)
 	mem = jsonp_malloc(sizeof(json_mem_t));
 	if (!mem) {
 		if (!own)
-			jsonp_free(v);
+			jsonp_free_sized(v, len);
 		return NULL;
 	}
 	json_init(&mem->json, JSON_MEM);
@@ -774,6 +835,26 @@ size_t json_mem_length(const json_t *json)
 	return json_to_mem(json)->length;
 }
 
+static void json_delete_mem(json_mem_t *mem)
+{
+	jsonp_free_sized(mem->value, mem->length);
+	jsonp_free(mem);
+}
+
+static json_t *json_mem_copy(const json_t *mem)
+{
+	return json_mem(json_mem_value(mem), json_mem_length(mem));
+}
+
+static int json_mem_equal(json_t *mem1, json_t *mem2)
+{
+	json_mem_t *m1, *m2;
+
+	m1 = json_to_mem(mem1);
+	m2 = json_to_mem(mem2);
+	return m1->length == m2->length && !memcmp(m1->value, m2->value, m1->length);
+}
+
 int json_string_set_nocheck(json_t *json, const char *value)
 {
 	if (!value)
@@ -795,6 +876,7 @@ int json_string_setn_nocheck(json_t *json, const char *value, size_t len)
 		return -1;
 
 	string = json_to_string(json);
+	value_modified(string);
 	jsonp_free(string->value);
 	string->value = dup;
 	string->length = len;
@@ -858,6 +940,7 @@ json_t *json_integer(json_int_t value)
 	json_init(&integer->json, JSON_INTEGER);
 
 	integer->value = value;
+	integer->hash_epoch = 0;
 	return &integer->json;
 }
 
@@ -874,6 +957,7 @@ int json_integer_set(json_t *json, json_int_t value)
 	if (!json_is_integer(json))
 		return -1;
 
+	value_modified(json_to_integer(json));
 	json_to_integer(json)->value = value;
 
 	return 0;
@@ -910,6 +994,7 @@ json_t *json_real(double value)
 	json_init(&real->json, JSON_REAL);
 
 	real->value = value;
+	real->hash_epoch = 0;
 	return &real->json;
 }
 
@@ -926,6 +1011,7 @@ int json_real_set(json_t *json, double value)
 	if (!json_is_real(json) || isnan(value) || isinf(value))
 		return -1;
 
+	value_modified(json_to_real(json));
 	json_to_real(json)->value = value;
 
 	return 0;
@@ -1000,6 +1086,9 @@ void json_delete(json_t *json)
 	case JSON_STRING:
 		json_delete_string(json_to_string(json));
 		break;
+	case JSON_MEM:
+		json_delete_mem(json_to_mem(json));
+		break;
 	case JSON_INTEGER:
 		json_delete_integer(json_to_integer(json));
 		break;
@@ -1016,8 +1105,26 @@ void json_delete(json_t *json)
 
 /*** equality ***/
 
+/* Fetches json's cached hash if it has one that is still current */
+static int hash_cached(const json_t *json, size_t *hash)
+{
+	size_t epoch = hash_epoch;
+
+	if (json_is_object(json) && json_to_object(json)->hash_epoch == epoch) {
+		*hash = json_to_object(json)->hash;
+		return 1;
+	}
+	if (json_is_array(json) && json_to_array(json)->hash_epoch == epoch) {
+		*hash = json_to_array(json)->hash;
+		return 1;
+	}
+	return 0;
+}
+
 int json_equal(json_t *json1, json_t *json2)
 {
+	size_t hash1, hash2;
+
 	if (!json1 || !json2)
 		return 0;
 
@@ -1028,6 +1135,12 @@ int json_equal(json_t *json1, json_t *json2)
 	if (json1 == json2)
 		return 1;
 
+	/* containers that json_hash() has seen cache their hash, which
+	   rejects most unequal trees without walking them */
+	if (hash_cached(json1, &hash1) && hash_cached(json2, &hash2) &&
+		hash1 != hash2)
+		return 0;
+
 	switch (json_typeof(json1)) {
 	case JSON_OBJECT:
 		return json_object_equal(json1, json2);
@@ -1035,6 +1148,8 @@ int json_equal(json_t *json1, json_t *json2)
 		return json_array_equal(json1, json2);
 	case JSON_STRING:
 		return json_string_equal(json1, json2);
+	case JSON_MEM:
+		return json_mem_equal(json1, json2);
 	case JSON_INTEGER:
 		return json_integer_equal(json1, json2);
 	case JSON_REAL:
@@ -1045,6 +1160,103 @@ int json_equal(json_t *json1, json_t *json2)
 }
 
 
+static uint64_t hash_mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static size_t do_hash(json_t *json, size_t epoch)
+{
+	uint64_t h = hash_mix((uint64_t)json_typeof(json) + 1);
+
+	switch (json_typeof(json)) {
+	case JSON_OBJECT:
+	{
+		json_object_t *object = json_to_object(json);
+		void *iter;
+
+		if (object->hash_epoch == epoch)
+			return object->hash;
+
+		/* object keys are unordered, so combine the items commutatively */
+		iter = hashtable_iter(&object->hashtable);
+		while (iter) {
+			h += hash_mix(hashtable_iter_hash(iter) ^
+				hash_mix(do_hash(hashtable_iter_value(iter), epoch)));
+			iter = hashtable_iter_next(&object->hashtable, iter);
+		}
+
+		object->hash = (size_t)hash_mix(h);
+		object->hash_epoch = epoch;
+		return object->hash;
+	}
+	case JSON_ARRAY:
+	{
+		json_array_t *array = json_to_array(json);
+		size_t i;
+
+		if (array->hash_epoch == epoch)
+			return array->hash;
+
+		for (i = 0; i < array->entries; i++)
+			h = hash_mix(h ^ do_hash(array->table[i], epoch));
+
+		array->hash = (size_t)hash_mix(h + array->entries);
+		array->hash_epoch = epoch;
+		return array->hash;
+	}
+	case JSON_STRING:
+		h ^= jsonp_hash_bytes(json_string_value(json), json_string_length(json));
+		json_to_string(json)->hash_epoch = epoch;
+		break;
+	case JSON_MEM:
+		h ^= jsonp_hash_bytes(json_mem_value(json), json_mem_length(json));
+		break;
+	case JSON_INTEGER:
+		h ^= (uint64_t)json_integer_value(json);
+		json_to_integer(json)->hash_epoch = epoch;
+		break;
+	case JSON_REAL:
+	{
+		uint64_t bits;
+		double value = json_real_value(json);
+
+		if (value == 0.0) /* -0.0 compares equal to 0.0 */
+			value = 0.0;
+		memcpy(&bits, &value, sizeof(bits));
+		h ^= bits;
+		json_to_real(json)->hash_epoch = epoch;
+		break;
+	}
+	default:
+		break;
+	}
+
+	return (size_t)hash_mix(h);
+}
+
+/*
+ * Returns a hash of the structure and contents of json such that values
+ * that compare equal with json_equal() hash equal. Container hashes are
+ * cached until the tree is modified, and json_equal() uses the cached
+ * hashes it finds to reject unequal trees early. Caching writes to the
+ * tree, so json_hash() must not race with other users of json. Object key hashes are seeded per
+ * process, so hashes are only meaningful within the current process.
+ */
+size_t json_hash(json_t *json)
+{
+	if (!json)
+		return 0;
+
+	return do_hash(json, hash_epoch);
+}
+
+
 /*** copying ***/
 
 json_t *json_copy(json_t *json)
@@ -1059,6 +1271,8 @@ json_t *json_copy(json_t *json)
 		return json_array_copy(json);
 	case JSON_STRING:
 		return json_string_copy(json);
+	case JSON_MEM:
+		return json_mem_copy(json);
 	case JSON_INTEGER:
 		return json_integer_copy(json);
 	case JSON_REAL:
@@ -1088,6 +1302,8 @@ json_t *json_deep_copy(const json_t *json)
 		   shallow copying */
 	case JSON_STRING:
 		return json_string_copy(json);
+	case JSON_MEM:
+		return json_mem_copy(json);
 	case JSON_INTEGER:
 		return json_integer_copy(json);
 	case JSON_REAL:
@@ -1102,3 +1318,102 @@ json_t *json_deep_copy(const json_t *json)
 
 	return NULL;
 }
+
+
+/*** copy-on-write ***/
+
+/*
+ * A copy-on-write copy shares the values that can't be modified in place
+ * with the original: mem buffers, which usually make up the bulk of a large
+ * document, and the true, false and null singletons. Containers, strings
+ * and numbers are duplicated, because a node doesn't know its parents, so a
+ * shared one couldn't be swapped out when something below it is written.
+ * Both trees can therefore be modified freely with the ordinary API.
+ *
+ * Cached hashes carry over, along with the stamps json_hash() left on the
+ * scalars, so a cached hash in the copy is invalidated by the same writes
+ * as in the original.
+ *
+ * Sharing takes a reference on each mem value, and json_incref() isn't
+ * atomic, so a value must not be copied while another thread changes the
+ * reference counts inside it, including by taking another copy.
+ */
+
+json_t *json_cow_copy(json_t *json)
+{
+	json_t *result;
+
+	if (!json)
+		return NULL;
+
+	switch (json_typeof(json)) {
+	case JSON_OBJECT:
+	{
+		json_object_t *src = json_to_object(json);
+		void *iter;
+
+		result = json_object();
+		if (!result)
+			return NULL;
+
+		iter = hashtable_iter(&src->hashtable);
+		while (iter) {
+			if (json_object_set_new_nocheck(result, hashtable_iter_key(iter),
+				json_cow_copy(hashtable_iter_value(iter))))
+			{
+				json_decref(result);
+				return NULL;
+			}
+			iter = hashtable_iter_next(&src->hashtable, iter);
+		}
+
+		json_to_object(result)->hash = src->hash;
+		json_to_object(result)->hash_epoch = src->hash_epoch;
+		return result;
+	}
+	case JSON_ARRAY:
+	{
+		json_array_t *src = json_to_array(json), *dest;
+		size_t i;
+
+		result = json_array();
+		if (!result)
+			return NULL;
+
+		dest = json_to_array(result);
+		if (!json_array_grow(dest, src->entries, 1)) {
+			json_decref(result);
+			return NULL;
+		}
+
+		for (i = 0; i < src->entries; i++) {
+			if (json_array_append_new(result, json_cow_copy(src->table[i]))) {
+				json_decref(result);
+				return NULL;
+			}
+		}
+
+		dest->hash = src->hash;
+		dest->hash_epoch = src->hash_epoch;
+		return result;
+	}
+	case JSON_STRING:
+		result = json_string_copy(json);
+		if (result)
+			json_to_string(result)->hash_epoch = json_to_string(json)->hash_epoch;
+		return result;
+	case JSON_INTEGER:
+		result = json_integer_copy(json);
+		if (result)
+			json_to_integer(result)->hash_epoch = json_to_integer(json)->hash_epoch;
+		return result;
+	case JSON_REAL:
+		result = json_real_copy(json);
+		if (result)
+			json_to_real(result)->hash_epoch = json_to_real(json)->hash_epoch;
+		return result;
+	default:
+		/* mem values and the singletons are never modified in place */
+		return json_incref(json);
+	}
+}
@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE //memfd_create and file sealing
+#endif
+
 #include "utils.h"
 
 #include <jansson_helper.h>
@@ -31,8 +35,22 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#endif
+#include <poll.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <spawn.h>
 #include <unistd.h>
 #include <wordexp.h>
+
+extern char ** environ;
 #endif
 
 #ifdef _WIN32
@@ -335,6 +353,95 @@ UTILS_API int get_process_status(HANDLE process)
 	return exitCode == STILL_ACTIVE;
 }
 #else
+static int fork_server_child_status(pid_t pid, int * status_out, int * wait_status_out, uint64_t * start_us_out);
+
+static uint64_t monotonic_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t monotonic_ms(void)
+{
+	return monotonic_us() / 1000;
+}
+
+/**
+ * Launch times of the processes we started, so their wall time can be reported when they're
+ * reaped.  The table is indexed by pid, a process whose entry was taken over by another pid just
+ * reports a wall time of 0.
+ */
+#define PROCESS_START_SLOTS 4096
+
+static struct {
+	pid_t pid;
+	uint64_t start_us;
+} process_starts[PROCESS_START_SLOTS];
+static pthread_mutex_t process_starts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void record_process_start(pid_t pid, uint64_t start_us)
+{
+	pthread_mutex_lock(&process_starts_lock);
+	process_starts[pid % PROCESS_START_SLOTS].pid = pid;
+	process_starts[pid % PROCESS_START_SLOTS].start_us = start_us;
+	pthread_mutex_unlock(&process_starts_lock);
+}
+
+static uint64_t take_process_start(pid_t pid)
+{
+	uint64_t start_us = 0;
+
+	pthread_mutex_lock(&process_starts_lock);
+	if (process_starts[pid % PROCESS_START_SLOTS].pid == pid) {
+		start_us = process_starts[pid % PROCESS_START_SLOTS].start_us;
+		process_starts[pid % PROCESS_START_SLOTS].pid = 0;
+	}
+	pthread_mutex_unlock(&process_starts_lock);
+	return start_us;
+}
+
+/**
+ * Fills in an extended status record from a waitpid status and the child's resource usage
+ * @param status - the record to fill in
+ * @param wait_status - the status from waitpid or wait4
+ * @param usage - the resource usage from wait4, or NULL if it isn't known
+ * @param wall_time_us - the time the child ran for, or 0 if it isn't known
+ * @return none
+ */
+static void fill_process_status_ex(process_status_ex_t * status, int wait_status, struct rusage * usage, uint64_t wall_time_us)
+{
+	memset(status, 0, sizeof(process_status_ex_t));
+	status->wall_time_us = wall_time_us;
+
+	if (WIFEXITED(wait_status)) {
+		status->result = FUZZ_NONE;
+		status->exit_code = WEXITSTATUS(wait_status);
+	}
+	else if (WIFSIGNALED(wait_status)) {
+		status->result = FUZZ_CRASH;
+		status->signal = WTERMSIG(wait_status);
+#ifdef WCOREDUMP
+		status->core_dumped = WCOREDUMP(wait_status) != 0;
+#endif
+	}
+	else
+		status->result = FUZZ_ERROR;
+
+	if (usage) {
+		status->user_time_us = (uint64_t)usage->ru_utime.tv_sec * 1000000 + usage->ru_utime.tv_usec;
+		status->system_time_us = (uint64_t)usage->ru_stime.tv_sec * 1000000 + usage->ru_stime.tv_usec;
+#ifdef __APPLE__
+		status->max_rss_kb = (uint64_t)usage->ru_maxrss / 1024; //bytes on macOS
+#else
+		status->max_rss_kb = (uint64_t)usage->ru_maxrss;
+#endif
+		status->minor_faults = (uint64_t)usage->ru_minflt;
+		status->major_faults = (uint64_t)usage->ru_majflt;
+	}
+}
+
 /**
  * This function checks if a CHILD process is still alive
  * @return - FUZZ_CRASH (2) if the process exited by crash, FUZZ_RUNNING (1) if
@@ -353,6 +460,10 @@ UTILS_API int get_process_status(pid_t pid)
 	int status;
 	pid_t result;
 
+	// Children of a fork server aren't our children, ask the server instead
+	if (fork_server_child_status(pid, &status, NULL, NULL))
+		return status;
+
 	// WNOHANG result: 0 means it exists and is alive, pid means it has exited,
 	// -1 means error
 	result = waitpid(pid, &status, WNOHANG);
@@ -360,6 +471,7 @@ UTILS_API int get_process_status(pid_t pid)
 	if(result == 0) {
 		return FUZZ_RUNNING;
 	} else if (result > 0) {
+		take_process_start(pid);
 		if(WIFEXITED(status))
 			return FUZZ_NONE; // it exited normally
 		if(WIFSIGNALED(status))
@@ -370,6 +482,47 @@ UTILS_API int get_process_status(pid_t pid)
 	// went wrong
 	return FUZZ_ERROR;
 }
+
+/**
+ * This function checks if a CHILD process is still alive, and once it has finished, how much
+ * it cost to run.  The resource usage comes from wait4, so getting it costs nothing over
+ * get_process_status.
+ * @param pid - the process to check
+ * @param status - a pointer to a process_status_ex_t that will be filled in.  When the process
+ * is still running, only the result is filled in.  Children of a fork server have no resource
+ * usage, as they aren't our children.
+ * @return - the same value as get_process_status, which is also stored in status->result
+ *
+ * NOTE: This should only be called once after a process has terminated.
+ */
+UTILS_API int get_process_status_ex(pid_t pid, process_status_ex_t * status)
+{
+	struct rusage usage;
+	uint64_t start_us;
+	int wait_status;
+	pid_t result;
+
+	memset(status, 0, sizeof(process_status_ex_t));
+	if (fork_server_child_status(pid, &status->result, &wait_status, &start_us)) {
+		if (status->result != FUZZ_RUNNING && status->result != FUZZ_ERROR)
+			fill_process_status_ex(status, wait_status, NULL, monotonic_us() - start_us);
+		return status->result;
+	}
+
+	result = wait4(pid, &wait_status, WNOHANG, &usage);
+	if (result == 0) {
+		status->result = FUZZ_RUNNING;
+		return FUZZ_RUNNING;
+	}
+	if (result < 0) {
+		status->result = FUZZ_ERROR;
+		return FUZZ_ERROR;
+	}
+
+	start_us = take_process_start(pid);
+	fill_process_status_ex(status, wait_status, &usage, start_us ? monotonic_us() - start_us : 0);
+	return status->result;
+}
 #endif
 
 /**
@@ -820,14 +973,7 @@ UTILS_API int log_msg(enum LOG_LEVEL level, const char * msg, ...)
 	return 0;
 }
 
-/**
- * Reads a file from disk
- * @param filename - The filename of the file to read
- * @param buffer - A pointer to a character buffer that will be assigned a newly allocated
- * buffer to hold the file contents.  The caller should free this buffer.
- * @return - -1 on failure, otherwise the number of bytes read from the file
- */
-UTILS_API int read_file(char * filename, char **buffer)
+static int read_file_inner(char * filename, char **buffer, int large)
 {
 	FILE *fp;
 	long fsize, total = 0, num_read;
@@ -843,7 +989,10 @@ UTILS_API int read_file(char * filename, char **buffer)
 	fsize = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	*buffer = (char *)malloc(fsize + 1);
+	if (large)
+		*buffer = (char *)json_large_malloc(fsize + 1, JSON_MEM_ALIGNMENT);
+	else
+		*buffer = (char *)malloc(fsize + 1);
 	if (!*buffer)
 	{
 		fclose(fp);
@@ -862,6 +1011,56 @@ UTILS_API int read_file(char * filename, char **buffer)
 	return fsize;
 }
 
+/**
+ * Reads a file from disk
+ * @param filename - The filename of the file to read
+ * @param buffer - A pointer to a character buffer that will be assigned a newly allocated
+ * buffer to hold the file contents.  The caller should free this buffer.
+ * @return - -1 on failure, otherwise the number of bytes read from the file
+ */
+UTILS_API int read_file(char * filename, char **buffer)
+{
+	return read_file_inner(filename, buffer, 0);
+}
+
+/**
+ * Reads a file from disk into a buffer from the large page allocator, so that big
+ * files reuse cached huge page mappings rather than faulting in fresh pages each time
+ * @param filename - The filename of the file to read
+ * @param buffer - A pointer to a character buffer that will be assigned a newly allocated
+ * buffer to hold the file contents.  The caller should free this buffer with free_file_buffer.
+ * @return - -1 on failure, otherwise the number of bytes read from the file
+ */
+UTILS_API int read_file_large(char * filename, char **buffer)
+{
+	return read_file_inner(filename, buffer, 1);
+}
+
+/**
+ * Frees a buffer returned by read_file_large
+ * @param buffer - The buffer to free
+ * @param length - The length read_file_large returned for the buffer
+ * @return none
+ */
+UTILS_API void free_file_buffer(char * buffer, int length)
+{
+	if (buffer)
+		json_large_free(buffer, (size_t)length + 1);
+}
+
+/**
+ * Makes jansson allocate mem payloads of at least threshold bytes from cached huge page
+ * mappings, see json_large_malloc.  This should be called before any JSON values are
+ * created, as values allocated before the switch can't be freed afterwards.
+ * @param threshold - The smallest payload to map, or 0 for the default of 2 MiB
+ * @return none
+ */
+UTILS_API void enable_large_page_allocator(size_t threshold)
+{
+	json_large_alloc_set_threshold(threshold ? threshold : JSON_LARGE_ALLOC_DEFAULT_THRESHOLD);
+	json_set_alloc_funcs_ex(json_large_malloc, json_large_free);
+}
+
 /**
  * This function prints a data buffer in hex
  * @param data - a char * data buffer
@@ -1047,6 +1246,10 @@ UTILS_API int split_command_line(char * cmd_line, char ** executable, char ***ar
 		wordfree(&wordexp_result);
 		return -1;
 	}
+	if(!wordexp_result.we_wordc) {
+		wordfree(&wordexp_result);
+		return -1;
+	}
 
 	target_executable = strdup(wordexp_result.we_wordv[0]);
 	target_argv = malloc(sizeof(char *) * (wordexp_result.we_wordc+1));
@@ -1076,85 +1279,2507 @@ UTILS_API int split_command_line(char * cmd_line, char ** executable, char ***ar
 	return 0;
 }
 
+static void close_fds(int * fds, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+		fds[i] = -1;
+	}
+}
+
 /**
- * This function starts a process and writes to the stdin of the process.
- * @param cmd_line - The command line of the new process to start.  The command line must start with the
- * path of the executable to start.
- * @param input - a buffer that should be pasesd to the newly created process's stdin
- * @param input_length - The length of the input parameter
- * @param process_out - a pointer to a pid_t that will be filled in with a handle to the newly created process
+ * Creates a pipe whose ends are close-on-exec from the start, so they can't leak into a
+ * child that another thread spawns before the flag would otherwise be set.
+ * @param fds - filled in with the read and write ends
  * @return - zero on success, non-zero on failure
  */
-UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, size_t input_length, pid_t * process_out)
+static int pipe_cloexec(int fds[2])
 {
-	int pipes[2];
-	int status, i;
-	pid_t child_pid;
+#ifdef __linux__
+	return pipe2(fds, O_CLOEXEC);
+#else
+	// Without pipe2 there is a short window in which a concurrent spawn inherits the pipe
+	if (pipe(fds))
+		return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+#endif
+}
+
+static int read_exact(int fd, void * buffer, size_t length)
+{
+	size_t total = 0;
 	ssize_t result;
-	size_t total_written = 0;
-	char * executable, **argv;
 
-	if(split_command_line(cmd_line, &executable, &argv))
-		return 1;
+	while (total < length) {
+		result = read(fd, (char *)buffer + total, length - total);
+		if (result > 0)
+			total += result;
+		else if (result == 0 || errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
 
-	if(pipe(pipes))
-		return 1;
+static int write_exact(int fd, const void * buffer, size_t length)
+{
+	size_t total = 0;
+	ssize_t result;
+
+	while (total < length) {
+		result = write(fd, (const char *)buffer + total, length - total);
+		if (result > 0)
+			total += result;
+		else if (result == 0 || errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
 
-	child_pid = fork();
-	if(child_pid < 0)
+/**
+ * Sets up a ring buffer that keeps the last size bytes written to it
+ * @param ring - the ring buffer to set up
+ * @param size - the number of bytes to keep
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int output_ring_init(output_ring_t * ring, size_t size)
+{
+	memset(ring, 0, sizeof(output_ring_t));
+	if (!size)
+		return 1;
+	ring->buffer = (char *)malloc(size);
+	if (!ring->buffer)
 		return 1;
-	else if(child_pid == 0) { //Child
+	ring->size = size;
+	return 0;
+}
 
-		// Open a file descriptor to /dev/null. I don't believe this needs to be closed.
-		int dev_null = open("/dev/null", O_WRONLY);
-		if (dev_null == -1 )
-			FATAL_MSG("Couldn't open /dev/null for child process.");
+/**
+ * Frees a ring buffer's memory
+ * @param ring - the ring buffer to free
+ * @return none
+ */
+UTILS_API void output_ring_free(output_ring_t * ring)
+{
+	free(ring->buffer);
+	memset(ring, 0, sizeof(output_ring_t));
+}
 
-		close(pipes[1]); // close the in side of the pipe for the child
-		// connect read side of pipe to child's stdin, closing the in side of the pipe for the child
-		dup2(pipes[0], STDIN_FILENO);
-		close(pipes[0]); // close fd attached to out side of pipe
+/**
+ * Empties a ring buffer so it can be reused for another process
+ * @param ring - the ring buffer to empty
+ * @return none
+ */
+UTILS_API void output_ring_reset(output_ring_t * ring)
+{
+	ring->head = 0;
+	ring->total = 0;
+}
 
-		// redirect child's stdout/stderr to devnull
-		dup2(dev_null, STDOUT_FILENO);
-		dup2(dev_null, STDERR_FILENO);
+/**
+ * Copies the bytes a ring buffer holds, oldest first
+ * @param ring - the ring buffer to copy from
+ * @param out - a buffer of at least ring->size bytes
+ * @return - the number of bytes copied, which is less than ring->total if older output was dropped
+ */
+UTILS_API size_t output_ring_copy(output_ring_t * ring, char * out)
+{
+	if (ring->total < ring->size) {
+		memcpy(out, ring->buffer, ring->head);
+		return ring->head;
+	}
 
-		// fd 1/2 now point to /dev/null, so it stays open.
-		close(dev_null);
+	memcpy(out, ring->buffer + ring->head, ring->size - ring->head);
+	memcpy(out + ring->size - ring->head, ring->buffer, ring->head);
+	return ring->size;
+}
 
-		execv(executable, argv);
-		exit(EXIT_FAILURE);
-	} // back to parent code
+/**
+ * Reads whatever a non-blocking descriptor has into a ring buffer, overwriting the oldest
+ * bytes once it's full.  At most limit bytes are read, so a process that writes without
+ * pause can't keep the caller here.
+ * @return - 1 once the descriptor reached end of file or failed, 0 otherwise
+ */
+static int output_ring_read_fd(output_ring_t * ring, int fd, size_t limit)
+{
+	size_t total_read = 0;
+	ssize_t result;
+
+	while (total_read < limit) {
+		result = read(fd, ring->buffer + ring->head, ring->size - ring->head);
+		if (result > 0) {
+			ring->head = (ring->head + result) % ring->size;
+			ring->total += result;
+			total_read += result;
+		}
+		else if (result == 0)
+			return 1;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		else if (errno != EINTR)
+			return 1;
+	}
+	return 0;
+}
+
+struct command {
+	char * executable;
+	char ** argv;
+	size_t argc;
+	size_t template_count; //number of arguments containing COMMAND_TEMPLATE
+	int input_mode;        //one of the INPUT_MODE values
+	int timeout_ms;        //how long to wait for the process to read its input, or 0 to wait forever
+};
+
+/**
+ * This function expands a command line once so it can be started many times with
+ * start_process_prepared.  Arguments containing COMMAND_TEMPLATE are substituted on each run.
+ * @param cmd_line - the command line to prepare.  The command line must start with the
+ * path of the executable to start.
+ * @return - a prepared command on success, or NULL on failure.  The command should be freed
+ * with command_free.
+ */
+UTILS_API command_t * command_prepare(char * cmd_line)
+{
+	command_t * command;
+
+	command = (command_t *)malloc(sizeof(command_t));
+	if (!command)
+		return NULL;
+	memset(command, 0, sizeof(command_t));
+
+	if (split_command_line(cmd_line, &command->executable, &command->argv)) {
+		free(command);
+		return NULL;
+	}
+
+	for (command->argc = 0; command->argv[command->argc]; command->argc++) {
+		if (strstr(command->argv[command->argc], COMMAND_TEMPLATE))
+			command->template_count++;
+	}
+
+	return command;
+}
+
+/**
+ * Frees a command from command_prepare
+ * @param command - the command to free
+ * @return none
+ */
+UTILS_API void command_free(command_t * command)
+{
+	size_t i;
+
+	if (!command)
+		return;
+
+	free(command->executable);
+	if (command->argv) {
+		for (i = 0; command->argv[i]; i++)
+			free(command->argv[i]);
+		free(command->argv);
+	}
+	free(command);
+}
+
+/**
+ * Chooses how start_process_prepared passes the input to the process
+ * @param command - the command to change
+ * @param input_mode - INPUT_PIPE to write the input to a pipe on stdin, INPUT_MEMFD_STDIN to
+ * give the process a sealed in-memory file as stdin, or INPUT_MEMFD_FILE to give it the sealed
+ * file as INPUT_MEMFD_PATH.  With INPUT_MEMFD_FILE, COMMAND_TEMPLATE is replaced by
+ * INPUT_MEMFD_PATH when no other template value is given.
+ * @return - zero on success, non-zero if the mode isn't supported on this system
+ */
+UTILS_API int command_set_input_mode(command_t * command, int input_mode)
+{
+	if (input_mode != INPUT_PIPE) {
+#ifdef __linux__
+		if (input_mode != INPUT_MEMFD_STDIN && input_mode != INPUT_MEMFD_FILE)
+			return 1;
+#else
+		return 1;
+#endif
+	}
+
+	command->input_mode = input_mode;
+	return 0;
+}
+
+/**
+ * Sets how long start_process_prepared waits for the process to read its input from a pipe
+ * @param command - the command to change
+ * @param timeout_ms - the maximum number of milliseconds to wait, or 0 to wait forever
+ * @return none
+ */
+UTILS_API void command_set_timeout(command_t * command, int timeout_ms)
+{
+	command->timeout_ms = timeout_ms < 0 ? 0 : timeout_ms;
+}
+
+/**
+ * Writes an input to a non-blocking pipe, waiting for room with poll rather than spinning
+ * @param pipe_wr - the non-blocking write end of the pipe
+ * @param input - the buffer to write
+ * @param input_length - the length of the input parameter
+ * @param timeout_ms - the maximum number of milliseconds to wait for the reader, or 0 to wait forever
+ * @return - 0 if everything was written, FUZZ_HANG if the reader didn't take the input before
+ * the deadline, or 1 if the reader went away or the write failed
+ */
+static int write_to_pipe_timeout(int pipe_wr, char * input, size_t input_length, int timeout_ms)
+{
+	uint64_t deadline = monotonic_ms() + timeout_ms;
+	size_t total_written = 0;
+	struct timespec no_wait = { 0, 0 };
+	sigset_t sigpipe, old_mask;
+	struct pollfd pfd;
+	ssize_t result;
+	int wait_ms, ret = 0;
 
-	close(pipes[0]);
+	// A child that exits without reading its input would raise SIGPIPE and kill us, so block it
+	// for this thread while writing and discard the one our write raised, if any
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
 
-	// Write the fuzz input to the child, from the parent.
+	pfd.fd = pipe_wr;
+	pfd.events = POLLOUT;
 	while (total_written < input_length)
 	{
-		result = write(pipes[1], input + total_written, input_length - total_written);
-		if (result > 0)
+		result = write(pipe_wr, input + total_written, input_length - total_written);
+		if (result > 0) {
 			total_written += result;
-		else if (result < 0 && errno != EAGAIN) //Error, then break
+			continue;
+		}
+		if (result < 0 && errno == EPIPE) {
+			if (!sigismember(&old_mask, SIGPIPE))
+				while (sigtimedwait(&sigpipe, NULL, &no_wait) < 0 && errno == EINTR)
+					;
+			ret = 1;
+			break;
+		}
+		if (result < 0 && errno != EAGAIN && errno != EINTR) {
+			ret = 1;
+			break;
+		}
+
+		// The pipe is full, wait for the child to read some of it
+		wait_ms = -1;
+		if (timeout_ms) {
+			uint64_t now = monotonic_ms();
+			if (now >= deadline) {
+				ret = FUZZ_HANG;
+				break;
+			}
+			wait_ms = (int)(deadline - now);
+		}
+
+		result = poll(&pfd, 1, wait_ms);
+		if ((result < 0 && errno != EINTR)
+			|| (result > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))) //The child closed stdin
+		{
+			ret = 1;
 			break;
+		}
 	}
 
-	close(pipes[1]);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	return ret;
+}
+
+#ifdef __linux__
+/**
+ * Puts an input in a new memfd and seals it, so neither the process reading it nor anybody
+ * else can change it
+ * @return - the file descriptor, positioned at the start of the input, or -1 on failure
+ */
+static int create_sealed_input(char * input, size_t input_length)
+{
+	int fd, moved;
+
+	fd = memfd_create("input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
 
-	// If the child stopped accepting input (write failed)
-	if(total_written != input_length)
+	if (write_exact(fd, input, input_length)
+		|| lseek(fd, 0, SEEK_SET) != 0
+		|| fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL))
 	{
-		kill(child_pid, 9);
-		wait(&status);
-		return 1;
+		close(fd);
+		return -1;
 	}
 
-	free(executable);
-	for(i = 0; argv[i]; i++)
-		free(argv[i]);
-	free(argv);
+	// dup2 onto the same descriptor wouldn't clear close-on-exec, so stay clear of it
+	if (fd == INPUT_MEMFD_FD) {
+		moved = fcntl(fd, F_DUPFD_CLOEXEC, INPUT_MEMFD_FD + 1);
+		close(fd);
+		fd = moved;
+	}
+	return fd;
+}
+#endif
+
+/**
+ * Replaces every COMMAND_TEMPLATE in an argument
+ * @return - a newly allocated argument, or NULL on failure
+ */
+static char * substitute_template(const char * arg, const char * value)
+{
+	size_t count = 0, template_length = strlen(COMMAND_TEMPLATE), value_length = strlen(value);
+	const char * pos, * match;
+	char * result, * out;
+
+	for (pos = arg; (match = strstr(pos, COMMAND_TEMPLATE)); pos = match + template_length)
+		count++;
+
+	result = (char *)malloc(strlen(arg) + count * value_length - count * template_length + 1);
+	if (!result)
+		return NULL;
+
+	out = result;
+	for (pos = arg; (match = strstr(pos, COMMAND_TEMPLATE)); pos = match + template_length) {
+		memcpy(out, pos, match - pos);
+		out += match - pos;
+		memcpy(out, value, value_length);
+		out += value_length;
+	}
+	strcpy(out, pos);
+	return result;
+}
+
+/**
+ * Creates the pipes a child's stdout and stderr are captured through.  Our read ends are
+ * non-blocking, so draining them never waits on the child.
+ * @param read_fds - filled in with the read ends for stdout and stderr
+ * @param write_fds - filled in with the write ends for stdout and stderr
+ * @return - zero on success, non-zero on failure
+ */
+static int create_output_pipes(int read_fds[2], int write_fds[2])
+{
+	int i, pipes[2];
+
+	read_fds[0] = read_fds[1] = write_fds[0] = write_fds[1] = -1;
+	for (i = 0; i < 2; i++) {
+		if (pipe_cloexec(pipes)) {
+			close_fds(read_fds, 2);
+			close_fds(write_fds, 2);
+			return 1;
+		}
+		fcntl(pipes[0], F_SETFL, fcntl(pipes[0], F_GETFL) | O_NONBLOCK);
+		read_fds[i] = pipes[0];
+		write_fds[i] = pipes[1];
+	}
+	return 0;
+}
+
+static int spawn_and_write_to_stdin(char * executable, char ** argv, int input_mode, char * input, size_t input_length,
+	int timeout_ms, int * output_fds, pid_t * process_out)
+{
+	int pipes[2] = { -1, -1 }, output_wr[2] = { -1, -1 }, input_fd = -1, failed;
+	pid_t child_pid;
+	posix_spawn_file_actions_t actions;
+
+	if (output_fds && create_output_pipes(output_fds, output_wr))
+		return 1;
+
+	if (input_mode == INPUT_PIPE) {
+		// Keep the pipe out of other children, dup2 clears the flag on the child's stdin
+		if (pipe_cloexec(pipes)) {
+			close_fds(output_wr, 2);
+			close_fds(output_fds, output_fds ? 2 : 0);
+			return 1;
+		}
+
+		// Only our end is non-blocking, the child gets an ordinary blocking stdin
+		fcntl(pipes[1], F_SETFL, fcntl(pipes[1], F_GETFL) | O_NONBLOCK);
+		input_fd = pipes[0];
+	}
+#ifdef __linux__
+	else {
+		input_fd = create_sealed_input(input, input_length);
+		if (input_fd < 0) {
+			close_fds(output_wr, 2);
+			close_fds(output_fds, output_fds ? 2 : 0);
+			return 1;
+		}
+	}
+#endif
+
+	// posix_spawn uses vfork or clone(CLONE_VM|CLONE_VFORK) where it can, so unlike fork
+	// the cost doesn't grow with the size of our address space
+	failed = posix_spawn_file_actions_init(&actions);
+	if (!failed) {
+		if (input_mode == INPUT_MEMFD_FILE)
+			failed = posix_spawn_file_actions_adddup2(&actions, input_fd, INPUT_MEMFD_FD)
+				|| posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+		else
+			failed = posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+
+		// redirect child's stdout/stderr to the capture pipes, or to devnull
+		if (output_fds)
+			failed = failed
+				|| posix_spawn_file_actions_adddup2(&actions, output_wr[0], STDOUT_FILENO)
+				|| posix_spawn_file_actions_adddup2(&actions, output_wr[1], STDERR_FILENO);
+		else
+			failed = failed
+				|| posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0)
+				|| posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+		failed = failed || posix_spawn(&child_pid, executable, &actions, NULL, argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+	}
+	if (!failed)
+		record_process_start(child_pid, monotonic_us());
+
+	close(input_fd);
+	close_fds(output_wr, 2);
+	if (failed) {
+		if (pipes[1] >= 0)
+			close(pipes[1]);
+		close_fds(output_fds, output_fds ? 2 : 0);
+		return 1;
+	}
+
+	if (input_mode == INPUT_PIPE) {
+		// Write the fuzz input to the child, from the parent.
+		failed = write_to_pipe_timeout(pipes[1], input, input_length, timeout_ms);
+		close(pipes[1]);
+
+		// If the child stopped accepting input (write failed or timed out)
+		if (failed)
+		{
+			kill(child_pid, 9);
+			waitpid(child_pid, NULL, 0);
+			take_process_start(child_pid);
+			close_fds(output_fds, output_fds ? 2 : 0);
+			return failed;
+		}
+	}
 
 	*process_out = child_pid;
 	return 0;
 }
 
+/**
+ * Starts a prepared command, see start_process_prepared
+ * @param timeout_ms - how long to wait for the process to read its input from a pipe, or 0 to
+ * wait forever.  Callers pass the command's own timeout, or a deadline of their own.
+ * @param output_fds - where to return the capture pipes, see start_process_prepared_capture, or
+ * NULL to discard the output
+ */
+static int start_process_prepared_inner(command_t * command, char * input, size_t input_length, const char * template_value,
+	int timeout_ms, int * output_fds, pid_t * process_out)
+{
+	char ** argv;
+	size_t i;
+	int ret;
+
+	if (!command->template_count)
+		return spawn_and_write_to_stdin(command->executable, command->argv, command->input_mode,
+			input, input_length, timeout_ms, output_fds, process_out);
+
+	if (!template_value && command->input_mode == INPUT_MEMFD_FILE)
+		template_value = INPUT_MEMFD_PATH;
+	if (!template_value)
+		return 1;
+
+	// Only the templated arguments are rebuilt, the rest are shared with the prepared argv
+	argv = (char **)malloc(sizeof(char *) * (command->argc + 1));
+	if (!argv)
+		return 1;
+
+	ret = 0;
+	for (i = 0; i <= command->argc; i++) {
+		argv[i] = command->argv[i];
+		if (argv[i] && strstr(argv[i], COMMAND_TEMPLATE)) {
+			argv[i] = substitute_template(argv[i], template_value);
+			if (!argv[i]) {
+				argv[i] = command->argv[i];
+				ret = 1;
+			}
+		}
+	}
+
+	if (!ret)
+		ret = spawn_and_write_to_stdin(command->executable, argv, command->input_mode,
+			input, input_length, timeout_ms, output_fds, process_out);
+
+	for (i = 0; i < command->argc; i++) {
+		if (argv[i] != command->argv[i])
+			free(argv[i]);
+	}
+	free(argv);
+	return ret;
+}
+
+
+/**
+ * This function starts a prepared command and writes to the stdin of the process.
+ * @param command - a command from command_prepare
+ * @param input - a buffer that should be pasesd to the newly created process's stdin
+ * @param input_length - The length of the input parameter
+ * @param template_value - the string to put in place of COMMAND_TEMPLATE in the arguments,
+ * or NULL if the command has no templates
+ * @param process_out - a pointer to a pid_t that will be filled in with a handle to the newly created process
+ * @return - zero on success, FUZZ_HANG if the process didn't read its input within the timeout
+ * set with command_set_timeout, or another non-zero value on failure
+ */
+UTILS_API int start_process_prepared(command_t * command, char * input, size_t input_length, const char * template_value, pid_t * process_out)
+{
+	return start_process_prepared_inner(command, input, input_length, template_value, command->timeout_ms, NULL, process_out);
+}
+
+/**
+ * This function starts a prepared command like start_process_prepared, but captures the process's
+ * stdout and stderr instead of discarding them.
+ * @param command - a command from command_prepare
+ * @param input - a buffer that should be pasesd to the newly created process's stdin
+ * @param input_length - The length of the input parameter
+ * @param template_value - the string to put in place of COMMAND_TEMPLATE in the arguments,
+ * or NULL if the command has no templates
+ * @param process_out - a pointer to a pid_t that will be filled in with a handle to the newly created process
+ * @param output_fds - filled in with the non-blocking read ends of the process's stdout and
+ * stderr, indexed by OUTPUT_STDOUT and OUTPUT_STDERR.  They should be drained while the process
+ * runs, for instance by process_watcher_add_output, or the process blocks once a pipe is full.
+ * @return - the same values as start_process_prepared
+ */
+UTILS_API int start_process_prepared_capture(command_t * command, char * input, size_t input_length, const char * template_value,
+	pid_t * process_out, int output_fds[2])
+{
+	return start_process_prepared_inner(command, input, input_length, template_value, command->timeout_ms, output_fds, process_out);
+}
+
+/**
+ * This function starts a process and writes to the stdin of the process.
+ * @param cmd_line - The command line of the new process to start.  The command line must start with the
+ * path of the executable to start.
+ * @param input - a buffer that should be pasesd to the newly created process's stdin
+ * @param input_length - The length of the input parameter
+ * @param process_out - a pointer to a pid_t that will be filled in with a handle to the newly created process
+ * @param timeout_ms - The maximum number of milliseconds to wait for the process to read its input, or 0
+ * to wait forever.  A process that times out is killed.
+ * @return - zero on success, FUZZ_HANG if the process didn't read its input in time, or another non-zero
+ * value on failure
+ */
+UTILS_API int start_process_and_write_to_stdin_timeout(char * cmd_line, char * input, size_t input_length, pid_t * process_out, int timeout_ms)
+{
+	char * executable, **argv;
+	int i, ret;
+
+	if(split_command_line(cmd_line, &executable, &argv))
+		return 1;
+
+	ret = spawn_and_write_to_stdin(executable, argv, INPUT_PIPE, input, input_length, timeout_ms, NULL, process_out);
+
+	free(executable);
+	for(i = 0; argv[i]; i++)
+		free(argv[i]);
+	free(argv);
+	return ret;
+}
+
+/**
+ * This function starts a process and writes to the stdin of the process.
+ * @param cmd_line - The command line of the new process to start.  The command line must start with the
+ * path of the executable to start.
+ * @param input - a buffer that should be pasesd to the newly created process's stdin
+ * @param input_length - The length of the input parameter
+ * @param process_out - a pointer to a pid_t that will be filled in with a handle to the newly created process
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, size_t input_length, pid_t * process_out)
+{
+	return start_process_and_write_to_stdin_timeout(cmd_line, input, input_length, process_out, 0);
+}
+
+/**
+ * Fork server support.  The target is started once with a pipe it reads commands from on
+ * FORK_SERVER_CONTROL_FD and a pipe it writes replies to on FORK_SERVER_STATUS_FD.  Once
+ * initialized, the target writes a four byte hello and then, for each four byte command, forks
+ * a child to run the test case, writes the child's pid and, when the child is done, its waitpid
+ * status.  The children share the server's stdin, a file that is rewritten for each test case.
+ *
+ * The pipes and messages follow AFL's fork server, but only targets that call
+ * fork_server_handshake are supported.  AFL instrumented binaries also expect a coverage map
+ * in shared memory named by __AFL_SHM_ID and, with AFL++, a reply to their hello, neither of
+ * which is provided here.
+ */
+
+//How long a fork server gets to answer a command before it's considered wedged
+#define FORK_SERVER_REPLY_TIMEOUT_MS 5000
+
+struct fork_server {
+	pid_t server_pid;
+	int control_fd;
+	int status_fd;
+	int input_fd;
+	int failed;                //set once the server stopped following the protocol
+	pthread_mutex_t lock;      //serializes the use of the pipes
+	pid_t child_pid;           //protected by fork_servers_lock
+	uint64_t child_start_us;
+	struct fork_server * next;
+};
+
+//Protects the list and the child pids only, it's never held across I/O with a server
+static fork_server_t * fork_servers = NULL;
+static pthread_mutex_t fork_servers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Waits for the next four byte message from a fork server
+ * @param server - the fork server to read from
+ * @param message - filled in with the message
+ * @param timeout_ms - how long to wait, 0 to only take a message that's already there, or -1
+ * to wait forever
+ * @return - 0 once the message was read, FUZZ_HANG if it didn't arrive in time, or 1 on error
+ */
+static int fork_server_read_message(fork_server_t * server, uint32_t * message, int timeout_ms)
+{
+	uint64_t deadline = monotonic_ms() + (timeout_ms > 0 ? timeout_ms : 0), now;
+	struct pollfd pfd;
+	int result, wait_ms = timeout_ms;
+
+	pfd.fd = server->status_fd;
+	pfd.events = POLLIN;
+	while ((result = poll(&pfd, 1, wait_ms)) < 0 && errno == EINTR) {
+		if (timeout_ms > 0) {
+			now = monotonic_ms();
+			wait_ms = now >= deadline ? 0 : (int)(deadline - now);
+		}
+	}
+
+	if (result == 0)
+		return FUZZ_HANG;
+	if (result < 0 || read_exact(server->status_fd, message, sizeof(*message)))
+		return 1;
+	return 0;
+}
+
+/**
+ * Reads the waitpid status of the server's current child, if it's available.  The caller must
+ * hold the server's lock.
+ * @param server - the fork server to check
+ * @param timeout_ms - how long to wait for the child to finish, or 0 to not wait
+ * @return - the FUZZ_* status of the child, FUZZ_RUNNING if it didn't finish in time
+ */
+static int fork_server_read_status(fork_server_t * server, int timeout_ms, int * wait_status_out)
+{
+	uint32_t status;
+	int result;
+
+	result = fork_server_read_message(server, &status, timeout_ms);
+	if (result == FUZZ_HANG)
+		return FUZZ_RUNNING;
+	if (result) {
+		server->failed = 1;
+		return FUZZ_ERROR;
+	}
+
+	if (wait_status_out)
+		*wait_status_out = (int)status;
+	if (WIFEXITED(status))
+		return FUZZ_NONE;
+	if (WIFSIGNALED(status))
+		return FUZZ_CRASH;
+	return FUZZ_ERROR;
+}
+
+static int fork_server_child_status(pid_t pid, int * status_out, int * wait_status_out, uint64_t * start_us_out)
+{
+	fork_server_t * server;
+	int found = 0;
+
+	pthread_mutex_lock(&fork_servers_lock);
+	for (server = fork_servers; server; server = server->next) {
+		if (server->child_pid && server->child_pid == pid) {
+			if (start_us_out)
+				*start_us_out = server->child_start_us;
+
+			// fork_server_run takes fork_servers_lock while holding the server's lock, so only
+			// try it here.  If a run is underway, it's reaping this child to start the next one.
+			if (pthread_mutex_trylock(&server->lock)) {
+				*status_out = FUZZ_RUNNING;
+			}
+			else {
+				*status_out = fork_server_read_status(server, 0, wait_status_out);
+				if (*status_out != FUZZ_RUNNING)
+					server->child_pid = 0;
+				pthread_mutex_unlock(&server->lock);
+			}
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fork_servers_lock);
+	return found;
+}
+
+/**
+ * Puts one of the fork server's pipes at the fd number the target expects it on, without the
+ * close-on-exec flag.  dup2 does nothing when the pipe is already there, so the flag is cleared
+ * by hand in that case.
+ * @return - zero on success, non-zero on failure
+ */
+static int fork_server_move_fd(int fd, int target)
+{
+	if (fd == target)
+		return fcntl(fd, F_SETFD, 0) < 0;
+	return dup2(fd, target) < 0;
+}
+
+/**
+ * Starts a fork server for a target and waits for it to reach its handshake point.  The target
+ * must call fork_server_handshake once it is initialized, AFL instrumented binaries aren't
+ * supported.
+ * @param cmd_line - The command line of the target.  The command line must start with the
+ * path of the executable to start.
+ * @param timeout_ms - How long to wait for the handshake, or 0 to wait forever
+ * @return - a fork server to pass to fork_server_run on success, or NULL on failure, for instance
+ * if the target exits without doing the handshake.  The fork server should be freed with
+ * fork_server_stop.
+ */
+UTILS_API fork_server_t * fork_server_start(char * cmd_line, int timeout_ms)
+{
+	int control_pipe[2] = { -1, -1 }, status_pipe[2] = { -1, -1 };
+	char input_template[] = "/tmp/fork_server_XXXXXX";
+	char * executable, ** argv;
+	fork_server_t * server;
+	uint32_t hello;
+	int i;
+
+	server = (fork_server_t *)malloc(sizeof(fork_server_t));
+	if (!server)
+		return NULL;
+	memset(server, 0, sizeof(fork_server_t));
+	server->control_fd = server->status_fd = -1;
+
+	if (split_command_line(cmd_line, &executable, &argv)) {
+		free(server);
+		return NULL;
+	}
+
+	// The input is rewritten for every run, so the memfd can't be sealed.  All of these are
+	// close-on-exec from the start so that other threads' children never inherit them, the
+	// dup2 calls in the server's child clear the flag on the copies it keeps.
+#ifdef __linux__
+	server->input_fd = memfd_create("fork_server_input", MFD_CLOEXEC);
+	if (server->input_fd < 0)
+#endif
+	{
+		server->input_fd = mkstemp(input_template);
+		if (server->input_fd >= 0) {
+			unlink(input_template);
+			fcntl(server->input_fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	if (server->input_fd < 0 || pipe_cloexec(control_pipe) || pipe_cloexec(status_pipe))
+		goto fail;
+
+	server->server_pid = fork();
+	if (server->server_pid < 0)
+		goto fail;
+	else if (server->server_pid == 0) { //Child
+		int dev_null = open("/dev/null", O_WRONLY);
+		if (dev_null == -1)
+			_exit(EXIT_FAILURE);
+
+		dup2(server->input_fd, STDIN_FILENO);
+		dup2(dev_null, STDOUT_FILENO);
+		dup2(dev_null, STDERR_FILENO);
+		if (fork_server_move_fd(control_pipe[0], FORK_SERVER_CONTROL_FD)
+			|| fork_server_move_fd(status_pipe[1], FORK_SERVER_STATUS_FD))
+			_exit(EXIT_FAILURE);
+
+		// Everything else is close-on-exec
+		close(dev_null);
+
+		execv(executable, argv);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(control_pipe[0]);
+	close(status_pipe[1]);
+	control_pipe[0] = status_pipe[1] = -1;
+	server->control_fd = control_pipe[1];
+	server->status_fd = status_pipe[0];
+
+	// Wait for the hello, the pipe closes without one if the target exits or doesn't take part
+	if (fork_server_read_message(server, &hello, timeout_ms ? timeout_ms : -1)) {
+		kill(server->server_pid, SIGKILL);
+		waitpid(server->server_pid, NULL, 0);
+		goto fail;
+	}
+
+	free(executable);
+	for (i = 0; argv[i]; i++)
+		free(argv[i]);
+	free(argv);
+
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_mutex_lock(&fork_servers_lock);
+	server->next = fork_servers;
+	fork_servers = server;
+	pthread_mutex_unlock(&fork_servers_lock);
+	return server;
+
+fail:
+	if (server->input_fd >= 0)
+		close(server->input_fd);
+	for (i = 0; i < 2; i++) {
+		if (control_pipe[i] >= 0)
+			close(control_pipe[i]);
+		if (status_pipe[i] >= 0)
+			close(status_pipe[i]);
+	}
+	free(executable);
+	for (i = 0; argv[i]; i++)
+		free(argv[i]);
+	free(argv);
+	free(server);
+	return NULL;
+}
+
+/**
+ * Runs one test case in a fresh child of a fork server.  This is the fork server equivalent of
+ * start_process_and_write_to_stdin, and the returned process can be checked with
+ * get_process_status in the same way.
+ * @param server - a fork server from fork_server_start
+ * @param input - a buffer that should be passed to the child's stdin
+ * @param input_length - The length of the input parameter
+ * @param process_out - a pointer to a pid_t that will be filled in with the pid of the child
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int fork_server_run(fork_server_t * server, char * input, size_t input_length, pid_t * process_out)
+{
+	uint32_t command = 0, child_pid;
+	pid_t previous;
+
+	pthread_mutex_lock(&server->lock);
+	if (server->failed) {
+		pthread_mutex_unlock(&server->lock);
+		return 1;
+	}
+
+	// Finish off a child that was never waited for, the server won't fork again until it's reaped
+	pthread_mutex_lock(&fork_servers_lock);
+	previous = server->child_pid;
+	pthread_mutex_unlock(&fork_servers_lock);
+	if (previous) {
+		// Once its status is in, the server has reaped it and the pid may belong to someone else
+		if (fork_server_read_status(server, 0, NULL) == FUZZ_RUNNING) {
+			kill(previous, SIGKILL);
+			if (fork_server_read_status(server, FORK_SERVER_REPLY_TIMEOUT_MS, NULL) == FUZZ_RUNNING)
+				server->failed = 1;
+		}
+		pthread_mutex_lock(&fork_servers_lock);
+		server->child_pid = 0;
+		pthread_mutex_unlock(&fork_servers_lock);
+	}
+
+	// The children share the file offset with the server, so rewind before and after writing.  A
+	// missing or late pid leaves the pipe out of step, so the server can't be used after that.
+	if (server->failed
+		|| ftruncate(server->input_fd, 0)
+		|| lseek(server->input_fd, 0, SEEK_SET) != 0
+		|| write_exact(server->input_fd, input, input_length)
+		|| lseek(server->input_fd, 0, SEEK_SET) != 0
+		|| write_exact(server->control_fd, &command, sizeof(command))
+		|| fork_server_read_message(server, &child_pid, FORK_SERVER_REPLY_TIMEOUT_MS)
+		|| (pid_t)child_pid <= 0) {
+		server->failed = 1;
+		pthread_mutex_unlock(&server->lock);
+		return 1;
+	}
+
+	pthread_mutex_lock(&fork_servers_lock);
+	server->child_pid = (pid_t)child_pid;
+	server->child_start_us = monotonic_us();
+	pthread_mutex_unlock(&fork_servers_lock);
+	pthread_mutex_unlock(&server->lock);
+
+	*process_out = (pid_t)child_pid;
+	return 0;
+}
+
+/**
+ * Stops a fork server, killing any running child, and frees it
+ * @param server - a fork server from fork_server_start
+ * @return none
+ */
+UTILS_API void fork_server_stop(fork_server_t * server)
+{
+	fork_server_t ** link;
+
+	if (!server)
+		return;
+
+	pthread_mutex_lock(&fork_servers_lock);
+	for (link = &fork_servers; *link; link = &(*link)->next) {
+		if (*link == server) {
+			*link = server->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fork_servers_lock);
+
+	if (server->child_pid && !server->failed && fork_server_read_status(server, 0, NULL) == FUZZ_RUNNING)
+		kill(server->child_pid, SIGKILL);
+	kill(server->server_pid, SIGKILL);
+	waitpid(server->server_pid, NULL, 0);
+
+	close(server->control_fd);
+	close(server->status_fd);
+	close(server->input_fd);
+	pthread_mutex_destroy(&server->lock);
+	free(server);
+}
+
+/**
+ * The target side of the fork server.  A target run under fork_server_start must call this
+ * once its initialization is done.  When the target was started by fork_server_start, this
+ * function only returns in the forked children, once per test case.  Otherwise it returns
+ * immediately and the target runs normally.
+ * @return none
+ */
+UTILS_API void fork_server_handshake(void)
+{
+	uint32_t message = 0;
+	pid_t child_pid;
+	int status;
+
+	// If the status pipe isn't there, we aren't running under a fork server
+	if (write(FORK_SERVER_STATUS_FD, &message, sizeof(message)) != sizeof(message))
+		return;
+
+	while (1) {
+		if (read_exact(FORK_SERVER_CONTROL_FD, &message, sizeof(message)))
+			_exit(EXIT_FAILURE);
+
+		child_pid = fork();
+		if (child_pid < 0)
+			_exit(EXIT_FAILURE);
+		else if (child_pid == 0) {
+			close(FORK_SERVER_CONTROL_FD);
+			close(FORK_SERVER_STATUS_FD);
+			return;
+		}
+
+		message = (uint32_t)child_pid;
+		if (write_exact(FORK_SERVER_STATUS_FD, &message, sizeof(message)))
+			_exit(EXIT_FAILURE);
+
+		while (waitpid(child_pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				_exit(EXIT_FAILURE);
+		}
+
+		message = (uint32_t)status;
+		if (write_exact(FORK_SERVER_STATUS_FD, &message, sizeof(message)))
+			_exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Process watchers.  Instead of polling get_process_status, a thread can add the children it
+ * starts to a watcher and block in process_watcher_wait until some of them exit, crash or run
+ * past their timeout.  Each child is watched through a pidfd in an epoll set.  On kernels
+ * without pidfd_open, the watcher falls back to a signalfd for SIGCHLD and checks every child
+ * it watches whenever one arrives.  Watched children are reaped by the watcher, so
+ * get_process_status can't be used on them.
+ */
+#ifdef __linux__
+
+typedef struct watched_process {
+	pid_t pid;
+	int pidfd;            //-1 when the watcher uses the signalfd
+	uint64_t start_us;
+	uint64_t deadline_us; //0 for no timeout
+	int timed_out;
+	void * context;
+	int output_fds[2];     //captured stdout and stderr, or -1
+	output_ring_t * rings; //where the captured output goes
+} watched_process_t;
+
+// The epoll data of a pidfd is the pid, and of an output pipe, the pid and stream + 1 in the
+// upper half.  The eventfd and signalfd are 0.
+#define WATCHER_OUTPUT_DATA(pid, stream) ((uint64_t)(uint32_t)(pid) | ((uint64_t)((stream) + 1) << 32))
+#define WATCHER_OUTPUT_STREAM(data) ((int)((data) >> 32) - 1)
+#define WATCHER_DATA_PID(data) ((pid_t)(uint32_t)(data))
+
+// The most output read from one pipe before going back to epoll_wait
+#define WATCHER_DRAIN_LIMIT (256 * 1024)
+
+struct process_watcher {
+	int epoll_fd;
+	int wake_fd;   //eventfd that interrupts process_watcher_wait when a child is added
+	int signal_fd; //-1 when the watcher uses pidfds
+	pthread_mutex_t lock;
+	watched_process_t * processes;
+	size_t count;
+	size_t allocated;
+	int woken;     //set by process_watcher_wake
+};
+
+static int pidfd_open_process(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int epoll_add_fd(int epoll_fd, int fd, uint64_t data)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = data;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * Creates a process watcher.  If pidfds aren't available, SIGCHLD is blocked in the calling
+ * thread so the watcher's signalfd receives it.  In that case SIGCHLD should also be blocked in
+ * every other thread, which is easiest done by creating the watcher before starting them.
+ * @return - a process watcher on success, or NULL on failure.  The watcher should be freed with
+ * process_watcher_destroy.
+ */
+UTILS_API process_watcher_t * process_watcher_create(void)
+{
+	process_watcher_t * watcher;
+	sigset_t mask;
+	int pidfd;
+
+	watcher = (process_watcher_t *)malloc(sizeof(process_watcher_t));
+	if (!watcher)
+		return NULL;
+	memset(watcher, 0, sizeof(process_watcher_t));
+	watcher->wake_fd = watcher->signal_fd = -1;
+	pthread_mutex_init(&watcher->lock, NULL);
+
+	watcher->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (watcher->epoll_fd < 0)
+		goto fail;
+
+	watcher->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (watcher->wake_fd < 0 || epoll_add_fd(watcher->epoll_fd, watcher->wake_fd, 0))
+		goto fail;
+
+	// Check whether the kernel has pidfd_open, otherwise fall back to the signalfd
+	pidfd = pidfd_open_process(getpid());
+	if (pidfd >= 0)
+		close(pidfd);
+	else {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		if (pthread_sigmask(SIG_BLOCK, &mask, NULL))
+			goto fail;
+
+		watcher->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+		if (watcher->signal_fd < 0 || epoll_add_fd(watcher->epoll_fd, watcher->signal_fd, 0))
+			goto fail;
+	}
+
+	return watcher;
+
+fail:
+	process_watcher_destroy(watcher);
+	return NULL;
+}
+
+/**
+ * Frees a process watcher.  Children that are still being watched are neither killed nor reaped.
+ * @param watcher - the watcher to free
+ * @return none
+ */
+UTILS_API void process_watcher_destroy(process_watcher_t * watcher)
+{
+	size_t i;
+
+	if (!watcher)
+		return;
+
+	for (i = 0; i < watcher->count; i++) {
+		if (watcher->processes[i].pidfd >= 0)
+			close(watcher->processes[i].pidfd);
+		close_fds(watcher->processes[i].output_fds, 2);
+	}
+	free(watcher->processes);
+
+	if (watcher->signal_fd >= 0)
+		close(watcher->signal_fd);
+	if (watcher->wake_fd >= 0)
+		close(watcher->wake_fd);
+	if (watcher->epoll_fd >= 0)
+		close(watcher->epoll_fd);
+	pthread_mutex_destroy(&watcher->lock);
+	free(watcher);
+}
+
+/**
+ * Starts watching a child process.  This function may be called from any thread, including while
+ * another thread is waiting in process_watcher_wait.
+ * @param watcher - the watcher to add the child to
+ * @param pid - the child to watch, which must be a child of this process
+ * @param timeout_ms - the number of milliseconds after which the child is killed and reported
+ * as a hang, or 0 for no timeout
+ * @param context - a pointer that is handed back in the child's process_event_t
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int process_watcher_add(process_watcher_t * watcher, pid_t pid, int timeout_ms, void * context)
+{
+	return process_watcher_add_output(watcher, pid, timeout_ms, context, NULL, NULL);
+}
+
+/**
+ * Starts watching a child process and draining its output.  The thread waiting in
+ * process_watcher_wait reads the output as it arrives, so the child never blocks on a full pipe,
+ * and keeps the last part of each stream in the given ring buffers.  Once the child's event is
+ * returned, the watcher is done with the ring buffers and has closed output_fds.
+ * @param watcher - the watcher to add the child to
+ * @param pid - the child to watch, which must be a child of this process
+ * @param timeout_ms - the number of milliseconds after which the child is killed and reported
+ * as a hang, or 0 for no timeout
+ * @param context - a pointer that is handed back in the child's process_event_t
+ * @param output_fds - the non-blocking read ends of the child's stdout and stderr, as returned by
+ * start_process_prepared_capture, or NULL.  The watcher takes ownership of them, even on failure.
+ * @param rings - two ring buffers, indexed by OUTPUT_STDOUT and OUTPUT_STDERR, that receive the
+ * output.  They must stay valid until the child's event is returned.
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int process_watcher_add_output(process_watcher_t * watcher, pid_t pid, int timeout_ms, void * context,
+	int output_fds[2], output_ring_t * rings)
+{
+	int no_output[2] = { -1, -1 }, * fds = output_fds && rings ? output_fds : no_output;
+	watched_process_t * process, * processes;
+	uint64_t wake = 1;
+	size_t allocated;
+	int i, pidfd = -1;
+
+	if (output_fds && !rings)
+		close_fds(output_fds, 2);
+
+	if (watcher->signal_fd < 0) {
+		pidfd = pidfd_open_process(pid);
+		if (pidfd < 0) {
+			close_fds(fds, 2);
+			return 1;
+		}
+		fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+	}
+
+	pthread_mutex_lock(&watcher->lock);
+	if (watcher->count == watcher->allocated) {
+		allocated = watcher->allocated ? watcher->allocated * 2 : 16;
+		processes = (watched_process_t *)realloc(watcher->processes, allocated * sizeof(watched_process_t));
+		if (!processes)
+			goto fail;
+		watcher->processes = processes;
+		watcher->allocated = allocated;
+	}
+
+	if (pidfd >= 0 && epoll_add_fd(watcher->epoll_fd, pidfd, (uint64_t)pid))
+		goto fail;
+	for (i = 0; i < 2; i++) {
+		if (fds[i] >= 0 && epoll_add_fd(watcher->epoll_fd, fds[i], WATCHER_OUTPUT_DATA(pid, i))) {
+			for (i--; i >= 0; i--) {
+				if (fds[i] >= 0)
+					epoll_ctl(watcher->epoll_fd, EPOLL_CTL_DEL, fds[i], NULL);
+			}
+			goto fail;
+		}
+	}
+
+	process = &watcher->processes[watcher->count++];
+	process->pid = pid;
+	process->pidfd = pidfd;
+	process->start_us = monotonic_us();
+	process->deadline_us = timeout_ms > 0 ? process->start_us + (uint64_t)timeout_ms * 1000 : 0;
+	process->timed_out = 0;
+	process->context = context;
+	process->output_fds[0] = fds[0];
+	process->output_fds[1] = fds[1];
+	process->rings = rings;
+	pthread_mutex_unlock(&watcher->lock);
+
+	// Wake the waiting thread so it picks up the new deadline, and in the signalfd case,
+	// notices a child that already exited before it was added
+	if (write(watcher->wake_fd, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+		return 1;
+	return 0;
+
+fail:
+	pthread_mutex_unlock(&watcher->lock);
+	if (pidfd >= 0)
+		close(pidfd); //also takes it out of the epoll set
+	close_fds(fds, 2);
+	return 1;
+}
+
+/**
+ * Drains one of a watched child's output streams, and stops watching it at end of file.  Must
+ * be called with the lock held.
+ * @param limit - the most bytes to read before returning
+ */
+static void process_watcher_drain(process_watcher_t * watcher, watched_process_t * process, int stream, size_t limit)
+{
+	int fd = process->output_fds[stream];
+
+	if (fd < 0)
+		return;
+	if (output_ring_read_fd(&process->rings[stream], fd, limit)) {
+		epoll_ctl(watcher->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+		process->output_fds[stream] = -1;
+	}
+}
+
+/**
+ * Reaps a watched child if it has exited and fills in its event.  Must be called with the lock held.
+ * @return - 1 if the child was reaped and removed from the watcher, 0 otherwise
+ */
+static int process_watcher_reap(process_watcher_t * watcher, size_t index, process_event_t * event)
+{
+	watched_process_t * process = &watcher->processes[index];
+	struct rusage usage;
+	uint64_t start_us;
+	pid_t result;
+	int status;
+
+	result = wait4(process->pid, &status, WNOHANG, &usage);
+	if (result == 0 || (result < 0 && errno == EINTR))
+		return 0;
+
+	// Measure from the launch if we started the child, otherwise from when it was added
+	start_us = take_process_start(process->pid);
+	if (!start_us)
+		start_us = process->start_us;
+
+	// Take what's left in the pipes.  A grandchild may still hold them open, so don't wait for
+	// end of file.
+	process_watcher_drain(watcher, process, OUTPUT_STDOUT, WATCHER_DRAIN_LIMIT);
+	process_watcher_drain(watcher, process, OUTPUT_STDERR, WATCHER_DRAIN_LIMIT);
+	close_fds(process->output_fds, 2);
+
+	memset(event, 0, sizeof(process_event_t));
+	event->pid = process->pid;
+	event->context = process->context;
+	if (result > 0)
+		fill_process_status_ex(&event->status, status, &usage, monotonic_us() - start_us);
+	else
+		event->status.result = FUZZ_ERROR;
+
+	// A child we killed for running too long is a hang, not a crash
+	if (process->timed_out)
+		event->status.result = FUZZ_HANG;
+
+	if (process->pidfd >= 0)
+		close(process->pidfd); //closing the last reference also removes it from the epoll set
+	*process = watcher->processes[--watcher->count];
+	return 1;
+}
+
+/**
+ * Makes the thread waiting in process_watcher_wait return, or the next call to it if no thread
+ * is waiting.  This function may be called from any thread.
+ * @param watcher - the watcher to wake
+ * @return none
+ */
+UTILS_API void process_watcher_wake(process_watcher_t * watcher)
+{
+	uint64_t wake = 1;
+
+	pthread_mutex_lock(&watcher->lock);
+	watcher->woken = 1;
+	pthread_mutex_unlock(&watcher->lock);
+	if (write(watcher->wake_fd, &wake, sizeof(wake)) < 0)
+		return; //the eventfd is already signaled
+}
+
+/**
+ * Waits for watched children to exit, crash or time out.  Only one thread should wait on a
+ * watcher at a time.
+ * @param watcher - the watcher to wait on
+ * @param events - an array that is filled in with one event per finished child
+ * @param max_events - the number of entries in the events array
+ * @param timeout_ms - the maximum number of milliseconds to wait, or 0 to wait forever
+ * @return - the number of events filled in, which is 0 if the wait timed out or was interrupted by
+ * process_watcher_wake, or -1 on failure
+ */
+UTILS_API int process_watcher_wait(process_watcher_t * watcher, process_event_t * events, int max_events, int timeout_ms)
+{
+	struct epoll_event ready[64];
+	struct signalfd_siginfo info;
+	uint64_t now, deadline, wake;
+	int i, count, found = 0, check_all, wait_ms, woken;
+	size_t j;
+
+	if (max_events <= 0)
+		return -1;
+
+	deadline = timeout_ms > 0 ? monotonic_ms() + timeout_ms : 0;
+	while (1) {
+		// Kill the children that are past their deadline, and find the next deadline to wake for
+		pthread_mutex_lock(&watcher->lock);
+		now = monotonic_us();
+		wait_ms = -1;
+		for (j = 0; j < watcher->count; j++) {
+			watched_process_t * process = &watcher->processes[j];
+			if (!process->deadline_us)
+				continue;
+			if (process->deadline_us <= now) {
+				kill(process->pid, SIGKILL);
+				process->timed_out = 1;
+				process->deadline_us = 0;
+			}
+			else if (wait_ms < 0 || (process->deadline_us - now + 999) / 1000 < (uint64_t)wait_ms)
+				wait_ms = (int)((process->deadline_us - now + 999) / 1000);
+		}
+		pthread_mutex_unlock(&watcher->lock);
+
+		if (deadline) {
+			now = monotonic_ms();
+			if (now >= deadline)
+				wait_ms = 0;
+			else if (wait_ms < 0 || deadline - now < (uint64_t)wait_ms)
+				wait_ms = (int)(deadline - now);
+		}
+
+		count = epoll_wait(watcher->epoll_fd, ready, ARRAY_SIZE(ready), wait_ms);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		pthread_mutex_lock(&watcher->lock);
+		check_all = 0;
+		for (i = 0; i < count; i++) {
+			if (WATCHER_OUTPUT_STREAM(ready[i].data.u64) >= 0) { //Output is waiting on a pipe
+				for (j = 0; j < watcher->count; j++) {
+					if (watcher->processes[j].pid == WATCHER_DATA_PID(ready[i].data.u64)) {
+						process_watcher_drain(watcher, &watcher->processes[j],
+							WATCHER_OUTPUT_STREAM(ready[i].data.u64), WATCHER_DRAIN_LIMIT);
+						break;
+					}
+				}
+				continue;
+			}
+			if (ready[i].data.u64 != 0) { //A pidfd became readable
+				for (j = 0; j < watcher->count; j++) {
+					if (watcher->processes[j].pid == WATCHER_DATA_PID(ready[i].data.u64)) {
+						if (found < max_events && process_watcher_reap(watcher, j, &events[found]))
+							found++;
+						break;
+					}
+				}
+				continue;
+			}
+
+			// The eventfd or signalfd, drain them.  SIGCHLDs are merged while one is pending,
+			// so any number of children may have exited.
+			while (read(watcher->wake_fd, &wake, sizeof(wake)) > 0)
+				;
+			if (watcher->signal_fd >= 0) {
+				while (read(watcher->signal_fd, &info, sizeof(info)) > 0)
+					;
+				check_all = 1;
+			}
+		}
+
+		// Also look at every child after a timeout kill, as the pidfd may have been reported
+		// readable while it was still being handled above
+		if (check_all || count == 0) {
+			for (j = 0; j < watcher->count && found < max_events; ) {
+				if (!process_watcher_reap(watcher, j, &events[found]))
+					j++;
+				else
+					found++;
+			}
+		}
+		woken = watcher->woken;
+		watcher->woken = 0;
+		pthread_mutex_unlock(&watcher->lock);
+
+		if (found || woken || (deadline && monotonic_ms() >= deadline))
+			return found;
+	}
+}
+
+#else
+
+UTILS_API process_watcher_t * process_watcher_create(void)
+{
+	return NULL;
+}
+
+UTILS_API void process_watcher_destroy(process_watcher_t * watcher)
+{
+	(void)watcher;
+}
+
+UTILS_API int process_watcher_add(process_watcher_t * watcher, pid_t pid, int timeout_ms, void * context)
+{
+	(void)watcher; (void)pid; (void)timeout_ms; (void)context;
+	return 1;
+}
+
+UTILS_API int process_watcher_add_output(process_watcher_t * watcher, pid_t pid, int timeout_ms, void * context,
+	int output_fds[2], output_ring_t * rings)
+{
+	(void)watcher; (void)pid; (void)timeout_ms; (void)context; (void)rings;
+	if (output_fds)
+		close_fds(output_fds, 2);
+	return 1;
+}
+
+UTILS_API void process_watcher_wake(process_watcher_t * watcher)
+{
+	(void)watcher;
+}
+
+UTILS_API int process_watcher_wait(process_watcher_t * watcher, process_event_t * events, int max_events, int timeout_ms)
+{
+	(void)watcher; (void)events; (void)max_events; (void)timeout_ms;
+	return -1;
+}
+
+#endif //__linux__
+
+/**
+ * Executors.  An executor runs test cases through a prepared command on up to N copies of the
+ * target at once.  Each slot is a thread that takes test cases from a queue and starts them with
+ * start_process_prepared.  When CPU pinning is on, the slot thread is pinned to its own core
+ * with sched_setaffinity, and the targets it starts inherit the pinning.  One reaper thread
+ * waits for all of the targets with a process watcher, and the results are queued for
+ * executor_get_result.  The timeout starts before the input is written, the slot bounds the
+ * write with it and the watcher enforces whatever is left.
+ */
+#ifdef __linux__
+
+typedef struct executor_job {
+	char * input;
+	size_t input_length;
+	char * template_value;
+	void * context;
+	struct executor_job * next;
+} executor_job_t;
+
+typedef struct executor_completion {
+	executor_result_t result;
+	struct executor_completion * next;
+} executor_completion_t;
+
+typedef struct executor_slot {
+	struct executor * executor;
+	int index;
+	int cpu;                  //the core the slot is pinned to, or -1
+	pthread_t thread;
+	pid_t pid;                //the running target, or 0
+	int done;                 //set by the reaper when the target finished
+	process_event_t event;
+	output_ring_t rings[2];   //the target's captured stdout and stderr
+	executor_slot_stats_t stats;
+} executor_slot_t;
+
+struct executor {
+	command_t * command;
+	int timeout_ms;
+	size_t capture_size;
+	int slot_count;
+	executor_slot_t * slots;
+	process_watcher_t * watcher;
+	pthread_t reaper;
+	int started_threads;
+	int reaper_started;
+	int stopping;
+	uint64_t start_us;
+
+	pthread_mutex_t lock;
+	pthread_cond_t job_ready;       //signaled when a job is queued
+	pthread_cond_t slot_done;       //signaled when the reaper finishes a slot's target
+	pthread_cond_t result_ready;    //signaled when a result is queued
+	executor_job_t * jobs, ** jobs_tail;
+	executor_completion_t * results, ** results_tail;
+};
+
+static void executor_job_free(executor_job_t * job)
+{
+	free(job->input);
+	free(job->template_value);
+	free(job);
+}
+
+/**
+ * Finds the index'th CPU this process may run on, wrapping around if there are fewer CPUs
+ * than index
+ * @return - the CPU number, or -1 if it can't be determined
+ */
+static int executor_slot_cpu(int index)
+{
+	cpu_set_t allowed;
+	int cpu, count;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+	count = CPU_COUNT(&allowed);
+	if (count <= 0)
+		return -1;
+
+	index %= count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+			return cpu;
+	}
+	return -1;
+}
+
+static void * executor_slot_thread(void * data)
+{
+	executor_slot_t * slot = (executor_slot_t *)data;
+	executor_t * executor = slot->executor;
+	executor_completion_t * completion;
+	executor_result_t * result;
+	executor_job_t * job;
+	int output_fds[2], timeout_ms;
+	uint64_t start_us, elapsed_ms;
+	cpu_set_t cpus;
+	pid_t pid;
+	int ret;
+
+	if (slot->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(slot->cpu, &cpus);
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+	}
+
+	pthread_mutex_lock(&executor->lock);
+	while (1) {
+		while (!executor->jobs && !executor->stopping)
+			pthread_cond_wait(&executor->job_ready, &executor->lock);
+		if (executor->stopping)
+			break;
+
+		job = executor->jobs;
+		executor->jobs = job->next;
+		if (!executor->jobs)
+			executor->jobs_tail = &executor->jobs;
+		pthread_mutex_unlock(&executor->lock);
+
+		completion = (executor_completion_t *)malloc(sizeof(executor_completion_t));
+		if (completion) {
+			memset(completion, 0, sizeof(executor_completion_t));
+			if (executor->capture_size)
+				completion->result.output[OUTPUT_STDOUT] = (char *)malloc(executor->capture_size * 2 + 2);
+		}
+
+		// The executor's timeout covers writing the input too, the watcher gets what's left of it
+		timeout_ms = executor->timeout_ms ? executor->timeout_ms : executor->command->timeout_ms;
+		if (executor->capture_size) {
+			output_ring_reset(&slot->rings[OUTPUT_STDOUT]);
+			output_ring_reset(&slot->rings[OUTPUT_STDERR]);
+		}
+		start_us = monotonic_us();
+		ret = start_process_prepared_inner(executor->command, job->input, job->input_length, job->template_value,
+			timeout_ms, executor->capture_size ? output_fds : NULL, &pid);
+		elapsed_ms = (monotonic_us() - start_us) / 1000;
+		if (!executor->timeout_ms)
+			timeout_ms = 0;
+		else
+			timeout_ms = elapsed_ms < (uint64_t)executor->timeout_ms ? executor->timeout_ms - (int)elapsed_ms : 1;
+
+		if (!ret && (executor->capture_size
+			? process_watcher_add_output(executor->watcher, pid, timeout_ms, slot, output_fds, slot->rings)
+			: process_watcher_add(executor->watcher, pid, timeout_ms, slot)))
+		{
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			ret = 1;
+		}
+
+		pthread_mutex_lock(&executor->lock);
+		if (!ret) {
+			// A stop while the target runs kills it, the reaper then reports it as usual
+			slot->pid = pid;
+			if (executor->stopping)
+				kill(pid, SIGKILL);
+			while (!slot->done)
+				pthread_cond_wait(&executor->slot_done, &executor->lock);
+			slot->done = 0;
+			slot->pid = 0;
+		}
+		else {
+			memset(&slot->event, 0, sizeof(process_event_t));
+			slot->event.status.result = ret == FUZZ_HANG ? FUZZ_HANG : FUZZ_ERROR;
+			slot->event.status.wall_time_us = monotonic_us() - start_us;
+		}
+
+		slot->stats.executions++;
+		slot->stats.busy_time_us += slot->event.status.wall_time_us;
+		if (slot->event.status.result == FUZZ_CRASH)
+			slot->stats.crashes++;
+		else if (slot->event.status.result == FUZZ_HANG)
+			slot->stats.hangs++;
+		else if (slot->event.status.result == FUZZ_ERROR)
+			slot->stats.errors++;
+
+		if (completion) {
+			completion->result.context = job->context;
+			completion->result.slot = slot->index;
+			completion->result.status = slot->event.status;
+			if (completion->result.output[OUTPUT_STDOUT]) {
+				// Both tails share one allocation, each NUL terminated for printing
+				result = &completion->result;
+				result->output_length[OUTPUT_STDOUT] = ret ? 0 : output_ring_copy(&slot->rings[OUTPUT_STDOUT], result->output[OUTPUT_STDOUT]);
+				result->output[OUTPUT_STDOUT][result->output_length[OUTPUT_STDOUT]] = 0;
+				result->output[OUTPUT_STDERR] = result->output[OUTPUT_STDOUT] + result->output_length[OUTPUT_STDOUT] + 1;
+				result->output_length[OUTPUT_STDERR] = ret ? 0 : output_ring_copy(&slot->rings[OUTPUT_STDERR], result->output[OUTPUT_STDERR]);
+				result->output[OUTPUT_STDERR][result->output_length[OUTPUT_STDERR]] = 0;
+			}
+			*executor->results_tail = completion;
+			executor->results_tail = &completion->next;
+			pthread_cond_signal(&executor->result_ready);
+		}
+		executor_job_free(job);
+	}
+	pthread_mutex_unlock(&executor->lock);
+	return NULL;
+}
+
+static void * executor_reaper_thread(void * data)
+{
+	executor_t * executor = (executor_t *)data;
+	process_event_t events[64];
+	executor_slot_t * slot;
+	int i, count;
+
+	while (1) {
+		count = process_watcher_wait(executor->watcher, events, ARRAY_SIZE(events), 0);
+
+		pthread_mutex_lock(&executor->lock);
+		for (i = 0; i < count; i++) {
+			slot = (executor_slot_t *)events[i].context;
+			slot->event = events[i];
+			slot->done = 1;
+		}
+		if (count > 0)
+			pthread_cond_broadcast(&executor->slot_done);
+
+		// Keep reaping until every slot thread has seen its target finish
+		if (executor->stopping && executor->started_threads == 0) {
+			pthread_mutex_unlock(&executor->lock);
+			break;
+		}
+		pthread_mutex_unlock(&executor->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Creates an executor that runs test cases with a prepared command
+ * @param command - a command from command_prepare.  The command must stay valid until the executor
+ * is destroyed, and shouldn't be changed in the meantime.
+ * @param slots - the number of copies of the target to run at once, or 0 for one per CPU
+ * @param timeout_ms - the number of milliseconds after which a target is killed and reported as
+ * FUZZ_HANG, or 0 for no timeout
+ * @param pin_cpus - non-zero to pin each slot, and the targets it starts, to its own CPU
+ * @param capture_size - the number of bytes at the end of each target's stdout and stderr to keep
+ * for the test case's result, or 0 to discard the output.  The output is drained while the target
+ * runs, so a target that writes more never blocks.
+ * @return - an executor on success, or NULL on failure.  The executor should be freed with
+ * executor_destroy.
+ */
+UTILS_API executor_t * executor_create(command_t * command, int slots, int timeout_ms, int pin_cpus, size_t capture_size)
+{
+	executor_t * executor;
+	int i;
+
+	if (slots <= 0) {
+		slots = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (slots <= 0)
+			slots = 1;
+	}
+
+	executor = (executor_t *)malloc(sizeof(executor_t));
+	if (!executor)
+		return NULL;
+	memset(executor, 0, sizeof(executor_t));
+	executor->command = command;
+	executor->timeout_ms = timeout_ms < 0 ? 0 : timeout_ms;
+	executor->capture_size = capture_size;
+	executor->start_us = monotonic_us();
+	executor->jobs_tail = &executor->jobs;
+	executor->results_tail = &executor->results;
+	pthread_mutex_init(&executor->lock, NULL);
+	pthread_cond_init(&executor->job_ready, NULL);
+	pthread_cond_init(&executor->slot_done, NULL);
+	pthread_cond_init(&executor->result_ready, NULL);
+
+	executor->slots = (executor_slot_t *)malloc(slots * sizeof(executor_slot_t));
+	executor->watcher = process_watcher_create();
+	if (!executor->slots || !executor->watcher)
+		goto fail;
+	memset(executor->slots, 0, slots * sizeof(executor_slot_t));
+	executor->slot_count = slots;
+
+	for (i = 0; capture_size && i < slots; i++) {
+		if (output_ring_init(&executor->slots[i].rings[OUTPUT_STDOUT], capture_size)
+			|| output_ring_init(&executor->slots[i].rings[OUTPUT_STDERR], capture_size))
+			goto fail;
+	}
+
+	if (pthread_create(&executor->reaper, NULL, executor_reaper_thread, executor))
+		goto fail;
+	executor->reaper_started = 1;
+
+	for (i = 0; i < slots; i++) {
+		executor->slots[i].executor = executor;
+		executor->slots[i].index = i;
+		executor->slots[i].cpu = pin_cpus ? executor_slot_cpu(i) : -1;
+		if (pthread_create(&executor->slots[i].thread, NULL, executor_slot_thread, &executor->slots[i]))
+			goto fail;
+		executor->started_threads++;
+	}
+
+	return executor;
+
+fail:
+	executor_destroy(executor);
+	return NULL;
+}
+
+/**
+ * Stops an executor and frees it.  Running targets are killed, and queued test cases and results
+ * that weren't collected are thrown away.
+ * @param executor - the executor to free
+ * @return none
+ */
+UTILS_API void executor_destroy(executor_t * executor)
+{
+	executor_completion_t * completion;
+	executor_job_t * job;
+	int i, started;
+
+	if (!executor)
+		return;
+
+	pthread_mutex_lock(&executor->lock);
+	executor->stopping = 1;
+	for (i = 0; i < executor->started_threads; i++) {
+		if (executor->slots[i].pid)
+			kill(executor->slots[i].pid, SIGKILL);
+	}
+	pthread_cond_broadcast(&executor->job_ready);
+	started = executor->started_threads;
+	pthread_mutex_unlock(&executor->lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(executor->slots[i].thread, NULL);
+
+	if (executor->reaper_started) {
+		pthread_mutex_lock(&executor->lock);
+		executor->started_threads = 0;
+		pthread_mutex_unlock(&executor->lock);
+		process_watcher_wake(executor->watcher);
+		pthread_join(executor->reaper, NULL);
+	}
+
+	while ((job = executor->jobs)) {
+		executor->jobs = job->next;
+		executor_job_free(job);
+	}
+	while ((completion = executor->results)) {
+		executor->results = completion->next;
+		executor_result_free(&completion->result);
+		free(completion);
+	}
+
+	process_watcher_destroy(executor->watcher);
+	for (i = 0; executor->slots && i < executor->slot_count; i++) {
+		output_ring_free(&executor->slots[i].rings[OUTPUT_STDOUT]);
+		output_ring_free(&executor->slots[i].rings[OUTPUT_STDERR]);
+	}
+	free(executor->slots);
+	pthread_cond_destroy(&executor->result_ready);
+	pthread_cond_destroy(&executor->slot_done);
+	pthread_cond_destroy(&executor->job_ready);
+	pthread_mutex_destroy(&executor->lock);
+	free(executor);
+}
+
+/**
+ * Queues a test case to run on the next free slot.  The input is copied, so the caller's buffer
+ * may be reused as soon as this function returns.
+ * @param executor - the executor to run the test case on
+ * @param input - the input to give the target
+ * @param input_length - The length of the input parameter
+ * @param template_value - the string to put in place of COMMAND_TEMPLATE, or NULL, see start_process_prepared
+ * @param context - a pointer that is handed back in the test case's executor_result_t
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int executor_submit(executor_t * executor, char * input, size_t input_length, const char * template_value, void * context)
+{
+	executor_job_t * job;
+
+	job = (executor_job_t *)malloc(sizeof(executor_job_t));
+	if (!job)
+		return 1;
+	memset(job, 0, sizeof(executor_job_t));
+	job->input_length = input_length;
+	job->context = context;
+
+	job->input = (char *)memdup(input, input_length ? input_length : 1);
+	if (!job->input || (template_value && !(job->template_value = strdup(template_value)))) {
+		executor_job_free(job);
+		return 1;
+	}
+
+	pthread_mutex_lock(&executor->lock);
+	*executor->jobs_tail = job;
+	executor->jobs_tail = &job->next;
+	pthread_cond_signal(&executor->job_ready);
+	pthread_mutex_unlock(&executor->lock);
+	return 0;
+}
+
+/**
+ * Takes the result of a finished test case, in the order they finish
+ * @param executor - the executor the test case was submitted to
+ * @param result - a pointer to an executor_result_t that will be filled in.  If the executor
+ * captures output, the result should be freed with executor_result_free.
+ * @param timeout_ms - the maximum number of milliseconds to wait for a result, or 0 to wait forever
+ * @return - 1 if a result was filled in, or 0 if none finished in time
+ */
+UTILS_API int executor_get_result(executor_t * executor, executor_result_t * result, int timeout_ms)
+{
+	executor_completion_t * completion;
+	struct timespec deadline;
+
+	if (timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&executor->lock);
+	while (!executor->results) {
+		if (timeout_ms <= 0)
+			pthread_cond_wait(&executor->result_ready, &executor->lock);
+		else if (pthread_cond_timedwait(&executor->result_ready, &executor->lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	completion = executor->results;
+	if (completion) {
+		executor->results = completion->next;
+		if (!executor->results)
+			executor->results_tail = &executor->results;
+	}
+	pthread_mutex_unlock(&executor->lock);
+
+	if (!completion)
+		return 0;
+	*result = completion->result;
+	free(completion);
+	return 1;
+}
+
+/**
+ * Frees the captured output of a result from executor_get_result
+ * @param result - the result whose output should be freed
+ * @return none
+ */
+UTILS_API void executor_result_free(executor_result_t * result)
+{
+	free(result->output[OUTPUT_STDOUT]);
+	result->output[OUTPUT_STDOUT] = result->output[OUTPUT_STDERR] = NULL;
+	result->output_length[OUTPUT_STDOUT] = result->output_length[OUTPUT_STDERR] = 0;
+}
+
+/**
+ * Gets the counters of one of an executor's slots.  The throughput of the slot is executions
+ * divided by elapsed_time_us, and its utilization is busy_time_us divided by elapsed_time_us.
+ * @param executor - the executor to get the counters from
+ * @param slot - the index of the slot
+ * @param stats - a pointer to an executor_slot_stats_t that will be filled in
+ * @return - zero on success, non-zero if the slot doesn't exist
+ */
+UTILS_API int executor_get_slot_stats(executor_t * executor, int slot, executor_slot_stats_t * stats)
+{
+	if (slot < 0 || slot >= executor->slot_count)
+		return 1;
+
+	pthread_mutex_lock(&executor->lock);
+	*stats = executor->slots[slot].stats;
+	pthread_mutex_unlock(&executor->lock);
+	stats->elapsed_time_us = monotonic_us() - executor->start_us;
+	return 0;
+}
+
+#else
+
+UTILS_API executor_t * executor_create(command_t * command, int slots, int timeout_ms, int pin_cpus, size_t capture_size)
+{
+	(void)command; (void)slots; (void)timeout_ms; (void)pin_cpus; (void)capture_size;
+	return NULL;
+}
+
+UTILS_API void executor_destroy(executor_t * executor)
+{
+	(void)executor;
+}
+
+UTILS_API int executor_submit(executor_t * executor, char * input, size_t input_length, const char * template_value, void * context)
+{
+	(void)executor; (void)input; (void)input_length; (void)template_value; (void)context;
+	return 1;
+}
+
+UTILS_API int executor_get_result(executor_t * executor, executor_result_t * result, int timeout_ms)
+{
+	(void)executor; (void)result; (void)timeout_ms;
+	return 0;
+}
+
+UTILS_API void executor_result_free(executor_result_t * result)
+{
+	(void)result;
+}
+
+UTILS_API int executor_get_slot_stats(executor_t * executor, int slot, executor_slot_stats_t * stats)
+{
+	(void)executor; (void)slot; (void)stats;
+	return 1;
+}
+
+#endif //__linux__
+
+/**
+ * Persistent process pools.  A pool keeps a number of long lived copies of a target that each
+ * run many inputs, for targets with their own input loop such as persistent harnesses and stdin
+ * driven REPLs.  Inputs go to the target's stdin, which stays open between runs.  With
+ * POOL_PROTOCOL_FRAMED, each input is a four byte length followed by the data, and the target
+ * answers each one with a four byte status on POOL_REPLY_FD, see process_pool_target_read and
+ * process_pool_target_reply.  With POOL_PROTOCOL_LINES, each input is followed by a newline and
+ * the target answers with a line on stdout.  A target that dies during a run is reported as
+ * FUZZ_CRASH, and one that doesn't answer in time is killed and reported as FUZZ_HANG.  Those
+ * processes, and any that reach the maximum number of runs, are replaced by a maintenance thread
+ * so process_pool_run never waits for a process to start while another one is ready.
+ */
+
+// How long a process that closed its pipes gets to finish exiting before it's killed
+#define POOL_EXIT_GRACE_MS 100
+// How long to wait before trying again to start a process that failed to start
+#define POOL_RESPAWN_DELAY_MS 100
+
+enum POOL_PROCESS_STATE {
+	POOL_IDLE,
+	POOL_BUSY,
+	POOL_RESTART, //waiting for the maintenance thread to replace it
+	POOL_FAILED,  //the last attempt to start it failed
+};
+
+typedef struct pool_process {
+	pid_t pid;
+	int input_fd;   //the write end of the process's stdin
+	int reply_fd;   //the read end of POOL_REPLY_FD, or of stdout for POOL_PROTOCOL_LINES
+	int executions;
+	int state;
+} pool_process_t;
+
+struct process_pool {
+	char * executable;
+	char ** argv;
+	int protocol;
+	int max_executions;
+	int timeout_ms;
+	int size;
+	pool_process_t * processes;
+
+	pthread_mutex_t lock;
+	pthread_cond_t idle;    //signaled when a process becomes idle or fails to start
+	pthread_cond_t restart; //signaled when a process needs replacing
+	pthread_t maintainer;
+	int maintainer_started;
+	int stopping;
+};
+
+static int pool_process_start(process_pool_t * pool, pool_process_t * process)
+{
+	int input_pipe[2] = { -1, -1 }, reply_pipe[2] = { -1, -1 }, moved, failed;
+	posix_spawn_file_actions_t actions;
+
+	if (pipe_cloexec(input_pipe) || pipe_cloexec(reply_pipe)) {
+		close_fds(input_pipe, 2);
+		return 1;
+	}
+	fcntl(input_pipe[1], F_SETFL, fcntl(input_pipe[1], F_GETFL) | O_NONBLOCK);
+	fcntl(reply_pipe[0], F_SETFL, fcntl(reply_pipe[0], F_GETFL) | O_NONBLOCK);
+
+	// dup2 onto the same descriptor wouldn't clear close-on-exec
+	if (reply_pipe[1] == POOL_REPLY_FD) {
+		moved = fcntl(reply_pipe[1], F_DUPFD_CLOEXEC, POOL_REPLY_FD + 1);
+		close(reply_pipe[1]);
+		reply_pipe[1] = moved;
+	}
+
+	failed = reply_pipe[1] < 0 || posix_spawn_file_actions_init(&actions);
+	if (!failed) {
+		failed = posix_spawn_file_actions_adddup2(&actions, input_pipe[0], STDIN_FILENO);
+		if (pool->protocol == POOL_PROTOCOL_LINES)
+			failed = failed
+				|| posix_spawn_file_actions_adddup2(&actions, reply_pipe[1], STDOUT_FILENO)
+				|| posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+		else
+			failed = failed
+				|| posix_spawn_file_actions_adddup2(&actions, reply_pipe[1], POOL_REPLY_FD)
+				|| posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0)
+				|| posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+		failed = failed || posix_spawn(&process->pid, pool->executable, &actions, NULL, pool->argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+	}
+
+	close(input_pipe[0]);
+	if (reply_pipe[1] >= 0)
+		close(reply_pipe[1]);
+	if (failed) {
+		close(input_pipe[1]);
+		close(reply_pipe[0]);
+		process->pid = 0;
+		return 1;
+	}
+
+	process->input_fd = input_pipe[1];
+	process->reply_fd = reply_pipe[0];
+	process->executions = 0;
+	return 0;
+}
+
+static void pool_process_stop(pool_process_t * process)
+{
+	int fds[2];
+
+	if (process->pid > 0) {
+		kill(process->pid, SIGKILL);
+		while (waitpid(process->pid, NULL, 0) < 0 && errno == EINTR)
+			;
+	}
+	process->pid = 0;
+
+	fds[0] = process->input_fd;
+	fds[1] = process->reply_fd;
+	close_fds(fds, 2);
+	process->input_fd = process->reply_fd = -1;
+}
+
+/**
+ * Reads a process's answer to an input.  Anything the process wrote before the input was sent
+ * has already been discarded.
+ * @param reply - filled in with the status for POOL_PROTOCOL_FRAMED
+ * @return - 0 once the answer arrived, FUZZ_HANG if it didn't arrive before the deadline, or 1 if
+ * the process closed the pipe
+ */
+static int pool_read_reply(process_pool_t * pool, pool_process_t * process, uint64_t deadline, int * reply)
+{
+	char buffer[4096];
+	size_t total = 0;
+	struct pollfd pfd;
+	ssize_t result;
+	uint32_t message;
+	int wait_ms;
+
+	pfd.fd = process->reply_fd;
+	pfd.events = POLLIN;
+	while (1) {
+		if (pool->protocol == POOL_PROTOCOL_LINES)
+			result = read(process->reply_fd, buffer, sizeof(buffer));
+		else
+			result = read(process->reply_fd, (char *)&message + total, sizeof(message) - total);
+
+		if (result > 0) {
+			if (pool->protocol == POOL_PROTOCOL_LINES) {
+				if (memchr(buffer, '\n', result))
+					return 0;
+				continue;
+			}
+			total += result;
+			if (total == sizeof(message)) {
+				*reply = (int)message;
+				return 0;
+			}
+			continue;
+		}
+		if (result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return 1;
+
+		wait_ms = -1;
+		if (deadline) {
+			uint64_t now = monotonic_ms();
+			if (now >= deadline)
+				return FUZZ_HANG;
+			wait_ms = (int)(deadline - now);
+		}
+		if (poll(&pfd, 1, wait_ms) < 0 && errno != EINTR)
+			return 1;
+	}
+}
+
+/**
+ * Converts a pool deadline into a timeout for write_to_pipe_timeout
+ * @param deadline - the monotonic_ms time the run must finish by, or 0 for none
+ * @return - the milliseconds left, at least 1 since write_to_pipe_timeout takes 0 as no timeout
+ */
+static int pool_time_left(uint64_t deadline)
+{
+	uint64_t now;
+
+	if (!deadline)
+		return 0;
+	now = monotonic_ms();
+	return now + 1 >= deadline ? 1 : (int)(deadline - now);
+}
+
+/**
+ * Reaps a pool process that closed its pipes, giving it a moment to finish exiting before it's
+ * killed.  Either way, wait_status and usage describe how it ended.
+ * @return - 0 if the process exited by itself, 1 if it had to be killed, or -1 if it couldn't be reaped
+ */
+static int pool_reap_process(pool_process_t * process, int * wait_status, struct rusage * usage)
+{
+	uint64_t deadline = monotonic_ms() + POOL_EXIT_GRACE_MS;
+	int killed = 0;
+	pid_t result;
+
+	while (1) {
+		result = wait4(process->pid, wait_status, killed ? 0 : WNOHANG, usage);
+		if (result == process->pid) {
+			process->pid = 0;
+			return killed;
+		}
+		if (result < 0 && errno != EINTR) {
+			process->pid = 0;
+			return -1;
+		}
+
+		if (result == 0) {
+			if (monotonic_ms() < deadline)
+				usleep(1000);
+			else {
+				kill(process->pid, SIGKILL);
+				killed = 1;
+			}
+		}
+	}
+}
+
+static void * pool_maintenance_thread(void * data)
+{
+	process_pool_t * pool = (process_pool_t *)data;
+	struct timespec retry;
+	pool_process_t * process;
+	int i, failed;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stopping) {
+		process = NULL;
+		failed = 0;
+		for (i = 0; i < pool->size && !process; i++) {
+			if (pool->processes[i].state == POOL_RESTART)
+				process = &pool->processes[i];
+			else if (pool->processes[i].state == POOL_FAILED)
+				failed = 1;
+		}
+
+		if (!process) {
+			if (!failed) {
+				pthread_cond_wait(&pool->restart, &pool->lock);
+				continue;
+			}
+
+			// Only processes that failed to start are left, try them again after a delay
+			clock_gettime(CLOCK_REALTIME, &retry);
+			retry.tv_nsec += POOL_RESPAWN_DELAY_MS * 1000000L;
+			if (retry.tv_nsec >= 1000000000) {
+				retry.tv_sec++;
+				retry.tv_nsec -= 1000000000;
+			}
+			if (pthread_cond_timedwait(&pool->restart, &pool->lock, &retry) != ETIMEDOUT)
+				continue;
+			for (i = 0; i < pool->size && !process; i++) {
+				if (pool->processes[i].state == POOL_FAILED)
+					process = &pool->processes[i];
+			}
+			if (!process)
+				continue;
+		}
+
+		process->state = POOL_BUSY;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_process_stop(process);
+		failed = pool_process_start(pool, process);
+
+		pthread_mutex_lock(&pool->lock);
+		process->state = failed ? POOL_FAILED : POOL_IDLE;
+		pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/**
+ * Starts a pool of persistent target processes
+ * @param cmd_line - The command line of the target.  The command line must start with the
+ * path of the executable to start.
+ * @param size - the number of processes to keep running
+ * @param protocol - POOL_PROTOCOL_FRAMED or POOL_PROTOCOL_LINES, see above
+ * @param max_executions - the number of inputs a process runs before it's replaced, or 0 to keep
+ * it until it crashes or hangs
+ * @param timeout_ms - the number of milliseconds a process gets to answer an input before it's
+ * killed and the input is reported as FUZZ_HANG, or 0 to wait forever
+ * @return - a process pool on success, or NULL on failure, for instance if the target can't be
+ * started.  The pool should be freed with process_pool_destroy.
+ */
+UTILS_API process_pool_t * process_pool_create(char * cmd_line, int size, int protocol, int max_executions, int timeout_ms)
+{
+	process_pool_t * pool;
+	int i;
+
+	if (size <= 0 || (protocol != POOL_PROTOCOL_FRAMED && protocol != POOL_PROTOCOL_LINES))
+		return NULL;
+
+	pool = (process_pool_t *)malloc(sizeof(process_pool_t));
+	if (!pool)
+		return NULL;
+	memset(pool, 0, sizeof(process_pool_t));
+	pool->protocol = protocol;
+	pool->max_executions = max_executions < 0 ? 0 : max_executions;
+	pool->timeout_ms = timeout_ms < 0 ? 0 : timeout_ms;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pthread_cond_init(&pool->restart, NULL);
+
+	pool->processes = (pool_process_t *)malloc(size * sizeof(pool_process_t));
+	if (!pool->processes || split_command_line(cmd_line, &pool->executable, &pool->argv))
+		goto fail;
+	for (i = 0; i < size; i++) {
+		memset(&pool->processes[i], 0, sizeof(pool_process_t));
+		pool->processes[i].input_fd = pool->processes[i].reply_fd = -1;
+		pool->processes[i].state = POOL_FAILED;
+	}
+	pool->size = size;
+
+	// The first processes are started up front, so a target that can't start fails here
+	for (i = 0; i < size; i++) {
+		if (pool_process_start(pool, &pool->processes[i]))
+			goto fail;
+		pool->processes[i].state = POOL_IDLE;
+	}
+
+	if (pthread_create(&pool->maintainer, NULL, pool_maintenance_thread, pool))
+		goto fail;
+	pool->maintainer_started = 1;
+	return pool;
+
+fail:
+	process_pool_destroy(pool);
+	return NULL;
+}
+
+/**
+ * Stops every process in a pool and frees it.  No other thread may be running inputs on the pool.
+ * @param pool - the pool to free
+ * @return none
+ */
+UTILS_API void process_pool_destroy(process_pool_t * pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	if (pool->maintainer_started) {
+		pthread_mutex_lock(&pool->lock);
+		pool->stopping = 1;
+		pthread_cond_broadcast(&pool->restart);
+		pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->lock);
+		pthread_join(pool->maintainer, NULL);
+	}
+
+	for (i = 0; i < pool->size; i++)
+		pool_process_stop(&pool->processes[i]);
+	free(pool->processes);
+
+	free(pool->executable);
+	if (pool->argv) {
+		for (i = 0; pool->argv[i]; i++)
+			free(pool->argv[i]);
+		free(pool->argv);
+	}
+
+	pthread_cond_destroy(&pool->restart);
+	pthread_cond_destroy(&pool->idle);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/**
+ * Runs an input on the next idle process in a pool, waiting for one if they're all busy.  This
+ * function may be called from several threads at once.
+ * @param pool - the pool to run the input on
+ * @param input - the input to give the target.  With POOL_PROTOCOL_LINES, it shouldn't contain a newline.
+ * @param input_length - The length of the input parameter
+ * @param status - optionally, a pointer to a process_status_ex_t that will be filled in.  The exit
+ * code is the target's reply with POOL_PROTOCOL_FRAMED.  The resource usage is only known when the
+ * process died, and covers its whole life.
+ * @return - FUZZ_NONE if the target answered, FUZZ_CRASH if it died or exited without answering,
+ * FUZZ_HANG if it didn't answer in time, or FUZZ_ERROR on failure
+ */
+UTILS_API int process_pool_run(process_pool_t * pool, char * input, size_t input_length, process_status_ex_t * status)
+{
+	process_status_ex_t local_status;
+	pool_process_t * process = NULL;
+	uint64_t start_us, deadline = 0;
+	uint32_t frame_length;
+	struct rusage usage;
+	char buffer[4096];
+	int i, ret, reply = 0, wait_status, available;
+
+	if (!status)
+		status = &local_status;
+	memset(status, 0, sizeof(process_status_ex_t));
+	status->result = FUZZ_ERROR;
+
+	if (pool->protocol == POOL_PROTOCOL_FRAMED && input_length > UINT32_MAX)
+		return FUZZ_ERROR;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!process) {
+		available = 0;
+		for (i = 0; i < pool->size && !process; i++) {
+			if (pool->processes[i].state == POOL_IDLE)
+				process = &pool->processes[i];
+			else if (pool->processes[i].state != POOL_FAILED)
+				available = 1;
+		}
+		if (process)
+			break;
+
+		// Don't wait for processes that can't be started
+		if (!available || pool->stopping) {
+			pthread_mutex_unlock(&pool->lock);
+			return FUZZ_ERROR;
+		}
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	}
+	process->state = POOL_BUSY;
+	pthread_mutex_unlock(&pool->lock);
+
+	// Throw away anything left over from the last input, so it isn't taken as this one's answer
+	while (read(process->reply_fd, buffer, sizeof(buffer)) > 0)
+		;
+
+	start_us = monotonic_us();
+	if (pool->timeout_ms)
+		deadline = start_us / 1000 + pool->timeout_ms;
+
+	// The writes and the reply share one deadline
+	frame_length = (uint32_t)input_length;
+	if (pool->protocol == POOL_PROTOCOL_FRAMED)
+		ret = write_to_pipe_timeout(process->input_fd, (char *)&frame_length, sizeof(frame_length), pool_time_left(deadline));
+	else
+		ret = 0;
+	if (!ret)
+		ret = write_to_pipe_timeout(process->input_fd, input, input_length, pool_time_left(deadline));
+	if (!ret && pool->protocol == POOL_PROTOCOL_LINES)
+		ret = write_to_pipe_timeout(process->input_fd, "\n", 1, pool_time_left(deadline));
+	if (!ret)
+		ret = pool_read_reply(pool, process, deadline, &reply);
+
+	if (!ret) {
+		status->result = FUZZ_NONE;
+		status->exit_code = reply;
+	}
+	else if (ret == FUZZ_HANG)
+		status->result = FUZZ_HANG;
+	else if (pool_reap_process(process, &wait_status, &usage) >= 0) {
+		fill_process_status_ex(status, wait_status, &usage, 0);
+		// Leaving without an answer is a failure on this input, sanitizers report errors by exiting
+		if (status->result == FUZZ_NONE)
+			status->result = FUZZ_CRASH;
+	}
+	status->wall_time_us = monotonic_us() - start_us;
+
+	pthread_mutex_lock(&pool->lock);
+	process->executions++;
+	if (ret || (pool->max_executions && process->executions >= pool->max_executions)) {
+		process->state = POOL_RESTART;
+		pthread_cond_signal(&pool->restart);
+	}
+	else {
+		process->state = POOL_IDLE;
+		pthread_cond_signal(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return status->result;
+}
+
+/**
+ * The target side of POOL_PROTOCOL_FRAMED.  Reads the next input from stdin.
+ * @param buffer - filled in with the input, which is NUL terminated and stays valid until the next call
+ * @param length - filled in with the length of the input
+ * @return - zero on success, or non-zero once the pool closed stdin, at which point the target should exit
+ */
+UTILS_API int process_pool_target_read(char ** buffer, size_t * length)
+{
+	static char * data = NULL;
+	static size_t allocated = 0;
+	uint32_t frame_length;
+	char * resized;
+
+	if (read_exact(STDIN_FILENO, &frame_length, sizeof(frame_length)))
+		return 1;
+
+	if ((size_t)frame_length + 1 > allocated) {
+		resized = (char *)realloc(data, (size_t)frame_length + 1);
+		if (!resized)
+			return 1;
+		data = resized;
+		allocated = (size_t)frame_length + 1;
+	}
+
+	if (read_exact(STDIN_FILENO, data, frame_length))
+		return 1;
+	data[frame_length] = 0;
+
+	*buffer = data;
+	*length = frame_length;
+	return 0;
+}
+
+/**
+ * The target side of POOL_PROTOCOL_FRAMED.  Tells the pool the target is done with the last input
+ * from process_pool_target_read.
+ * @param status - a value that is handed back as the exit code of the run
+ * @return none
+ */
+UTILS_API void process_pool_target_reply(int status)
+{
+	uint32_t message = (uint32_t)status;
+
+	if (write_exact(POOL_REPLY_FD, &message, sizeof(message)))
+		_exit(EXIT_FAILURE);
+}
+
 #endif //!_WIN32
@@ -6,6 +6,7 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <dlfcn.h>
+#include <sys/resource.h>
 #ifdef __APPLE__
 #include <sys/syslimits.h>
 #else
@@ -58,7 +59,22 @@ UTILS_API wchar_t * convert_char_array_to_wchar(char * string, wchar_t * out_buf
 UTILS_API char * convert_wchar_array_to_char(wchar_t * string, char * out_buffer);
 UTILS_API int get_process_status(HANDLE process);
 #else
+//The cost and outcome of a finished process, see get_process_status_ex
+typedef struct process_status_ex {
+	int result;              //FUZZ_RUNNING, FUZZ_NONE, FUZZ_CRASH, FUZZ_HANG or FUZZ_ERROR
+	int exit_code;           //the exit code, if the process exited
+	int signal;              //the signal that killed the process, if it was killed
+	int core_dumped;         //non-zero if the process dumped core
+	uint64_t wall_time_us;   //from the launch until the process was reaped, 0 if unknown
+	uint64_t user_time_us;
+	uint64_t system_time_us;
+	uint64_t max_rss_kb;
+	uint64_t minor_faults;
+	uint64_t major_faults;
+} process_status_ex_t;
+
 UTILS_API int get_process_status(pid_t process);
+UTILS_API int get_process_status_ex(pid_t process, process_status_ex_t * status);
 #endif
 
 UTILS_API char * get_temp_filename(char * suffix);
@@ -66,6 +82,9 @@ UTILS_API int file_exists(char * path);
 UTILS_API int write_buffer_to_file(char * filename, char * buffer, size_t length);
 UTILS_API char * filename_relative_to_binary_dir(char * relative_path);
 UTILS_API int read_file(char * filename, char **buffer);
+UTILS_API int read_file_large(char * filename, char **buffer);
+UTILS_API void free_file_buffer(char * buffer, int length);
+UTILS_API void enable_large_page_allocator(size_t threshold);
 UTILS_API void print_hex(char * data, size_t size);
 UTILS_API void md5(uint8_t *initial_msg, size_t initial_len, char * output, size_t output_size);
 UTILS_API void * memdup(void * src, size_t length);
@@ -82,6 +101,117 @@ UTILS_API void destroy_semaphore(semaphore_t semaphore);
 #ifndef _WIN32
 UTILS_API int split_command_line(char * cmd_line, char ** executable, char ***argv);
 UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, size_t input_length, pid_t * process_out);
+UTILS_API int start_process_and_write_to_stdin_timeout(char * cmd_line, char * input, size_t input_length, pid_t * process_out, int timeout_ms);
+
+//Prepared command lines, expanded once and started many times
+#define COMMAND_TEMPLATE "@@"
+
+typedef struct command command_t;
+
+//The last size bytes of a captured output stream
+typedef struct output_ring {
+	char * buffer;
+	size_t size;
+	size_t head;    //where the next byte goes
+	uint64_t total; //the number of bytes the stream produced
+} output_ring_t;
+
+#define OUTPUT_STDOUT 0
+#define OUTPUT_STDERR 1
+
+UTILS_API int output_ring_init(output_ring_t * ring, size_t size);
+UTILS_API void output_ring_free(output_ring_t * ring);
+UTILS_API void output_ring_reset(output_ring_t * ring);
+UTILS_API size_t output_ring_copy(output_ring_t * ring, char * out);
+
+//How start_process_prepared passes the input, see command_set_input_mode
+enum INPUT_MODE {
+	INPUT_PIPE,
+	INPUT_MEMFD_STDIN,
+	INPUT_MEMFD_FILE,
+};
+
+#define INPUT_MEMFD_FD 3
+#define INPUT_MEMFD_PATH "/dev/fd/3"
+
+UTILS_API command_t * command_prepare(char * cmd_line);
+UTILS_API void command_free(command_t * command);
+UTILS_API int command_set_input_mode(command_t * command, int input_mode);
+UTILS_API void command_set_timeout(command_t * command, int timeout_ms);
+UTILS_API int start_process_prepared(command_t * command, char * input, size_t input_length, const char * template_value, pid_t * process_out);
+UTILS_API int start_process_prepared_capture(command_t * command, char * input, size_t input_length, const char * template_value,
+	pid_t * process_out, int output_fds[2]);
+
+//Fork server, the control file descriptors match AFL's
+#define FORK_SERVER_CONTROL_FD 198
+#define FORK_SERVER_STATUS_FD  199
+
+typedef struct fork_server fork_server_t;
+
+UTILS_API fork_server_t * fork_server_start(char * cmd_line, int timeout_ms);
+UTILS_API int fork_server_run(fork_server_t * server, char * input, size_t input_length, pid_t * process_out);
+UTILS_API void fork_server_stop(fork_server_t * server);
+UTILS_API void fork_server_handshake(void);
+
+//Process watchers, event driven reaping of many children from one thread
+typedef struct process_watcher process_watcher_t;
+
+typedef struct process_event {
+	pid_t pid;
+	process_status_ex_t status; //the result is FUZZ_NONE, FUZZ_CRASH, FUZZ_HANG or FUZZ_ERROR
+	void * context;             //the context passed to process_watcher_add
+} process_event_t;
+
+UTILS_API process_watcher_t * process_watcher_create(void);
+UTILS_API void process_watcher_destroy(process_watcher_t * watcher);
+UTILS_API int process_watcher_add(process_watcher_t * watcher, pid_t pid, int timeout_ms, void * context);
+UTILS_API int process_watcher_add_output(process_watcher_t * watcher, pid_t pid, int timeout_ms, void * context,
+	int output_fds[2], output_ring_t * rings);
+UTILS_API void process_watcher_wake(process_watcher_t * watcher);
+UTILS_API int process_watcher_wait(process_watcher_t * watcher, process_event_t * events, int max_events, int timeout_ms);
+
+//Executors, run test cases on several copies of a target at once
+typedef struct executor executor_t;
+
+typedef struct executor_result {
+	void * context;             //the context passed to executor_submit
+	int slot;                   //the slot that ran the test case
+	process_status_ex_t status; //the result is FUZZ_NONE, FUZZ_CRASH, FUZZ_HANG or FUZZ_ERROR
+	char * output[2];           //the end of stdout and stderr, NUL terminated, or NULL if not captured
+	size_t output_length[2];
+} executor_result_t;
+
+typedef struct executor_slot_stats {
+	uint64_t executions;
+	uint64_t crashes;
+	uint64_t hangs;
+	uint64_t errors;
+	uint64_t busy_time_us;    //time spent running test cases
+	uint64_t elapsed_time_us; //time since the executor was created
+} executor_slot_stats_t;
+
+UTILS_API executor_t * executor_create(command_t * command, int slots, int timeout_ms, int pin_cpus, size_t capture_size);
+UTILS_API void executor_destroy(executor_t * executor);
+UTILS_API int executor_submit(executor_t * executor, char * input, size_t input_length, const char * template_value, void * context);
+UTILS_API int executor_get_result(executor_t * executor, executor_result_t * result, int timeout_ms);
+UTILS_API void executor_result_free(executor_result_t * result);
+UTILS_API int executor_get_slot_stats(executor_t * executor, int slot, executor_slot_stats_t * stats);
+
+//Persistent process pools, long lived targets that each run many inputs
+#define POOL_REPLY_FD 197
+
+enum POOL_PROTOCOL {
+	POOL_PROTOCOL_FRAMED, //a four byte length and the input on stdin, a four byte status on POOL_REPLY_FD
+	POOL_PROTOCOL_LINES,  //the input and a newline on stdin, a line on stdout
+};
+
+typedef struct process_pool process_pool_t;
+
+UTILS_API process_pool_t * process_pool_create(char * cmd_line, int size, int protocol, int max_executions, int timeout_ms);
+UTILS_API void process_pool_destroy(process_pool_t * pool);
+UTILS_API int process_pool_run(process_pool_t * pool, char * input, size_t input_length, process_status_ex_t * status);
+UTILS_API int process_pool_target_read(char ** buffer, size_t * length);
+UTILS_API void process_pool_target_reply(int status);
 #endif
 
 //Logging